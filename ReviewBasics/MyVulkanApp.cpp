@@ -81,7 +81,7 @@ std::tuple<std::vector<Vertex>, std::vector<uint32_t>> CreateTorusMesh(float out
 void MyVulkanApp::userInit()
 {
     //init shader
-    shader.init(device, swapChain.extent(), swapChain.imageFormat(), depthImageFormat);
+    shader.init(device, swapChain.extent(), swapChain.imageFormat(), depthImageFormat, pipelineCache.handle());
     shader.createColorDepthRenderPass();
     std::vector<vk::VertexInputBindingDescription> vertexBindingDescription;
     vertexBindingDescription.push_back({ 0, sizeof(Vertex), vk::VertexInputRate::eVertex });
@@ -1,9 +1,10 @@
 #include "SimpleShaderPipeline.h"
 #include<fstream>
 
-void SimpleShaderPipeline::init(const vk::Device device, const vk::Extent2D windowExtent, const vk::Format framebufferFormat, const vk::Format depthStencilFormat)
+void SimpleShaderPipeline::init(const vk::Device device, const vk::Extent2D windowExtent, const vk::Format framebufferFormat, const vk::Format depthStencilFormat, const vk::PipelineCache pipelineCache)
 {
     this->device = device;
+    this->pipelineCache = pipelineCache;
     this->framebufferFormat = framebufferFormat;
     this->depthStencilFormat = depthStencilFormat;
 
@@ -136,7 +137,7 @@ void SimpleShaderPipeline::createPipeline()
         &viewportInfo, &rasterizer, &multisampleInfo,
         &depthStencilStateCreateInfo, &colorBlendStateInfo, nullptr, pipelineLayout, renderPass, 0);
 
-    pipeline = device.createGraphicsPipeline({}, pipelineInfo);
+    pipeline = device.createGraphicsPipeline(pipelineCache, pipelineInfo);
 }
 
 void SimpleShaderPipeline::destroy()
@@ -5,7 +5,7 @@
 class SimpleShaderPipeline
 {
 public:
-    void init(const vk::Device device, const vk::Extent2D windowExtent, const vk::Format framebufferFormat, const vk::Format depthStencilFormat);
+    void init(const vk::Device device, const vk::Extent2D windowExtent, const vk::Format framebufferFormat, const vk::Format depthStencilFormat, const vk::PipelineCache pipelineCache = {});
     void createColorOnlyRenderPass();
     void createColorDepthRenderPass();
     void createDefaultVFShader(const std::string& vertexShaderPath, const std::string& fragmentShaderPath,
@@ -22,6 +22,7 @@ public:
     void destroy();
 private:
     vk::Device device;
+    vk::PipelineCache pipelineCache;
     vk::PipelineLayout pipelineLayout;
     vk::Pipeline pipeline;
     vk::RenderPass renderPass;
@@ -24,6 +24,7 @@ void VulkanApp::init()
     std::tie(swapChainImages, swapChainImageViews) = swapChain.getSwapChainImages();
     vk::CommandPoolCreateInfo commandPoolInfo({}, context.getQueueFamilyIndex());
     commandPool = device.createCommandPool(commandPoolInfo);
+    pipelineCache.init(context.getPhysicalDeviceHandle(), device);
 
     createDepthResources();
 
@@ -49,6 +50,7 @@ void VulkanApp::cleanup()
     }
 
     device.destroyCommandPool(commandPool);
+    pipelineCache.destroy();
     swapChain.destroy();
     device.destroy();
     context.destroy();
@@ -3,6 +3,7 @@
 #include"VulkanContext.h"
 #include"EasyUseSwapChain.h"
 #include"SimpleShaderPipeline.h"
+#include"PipelineCache.h"
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include<glm.hpp>
 #include<gtc/matrix_transform.hpp>
@@ -25,6 +26,7 @@ protected:
     vk::Device device;
     vk::Queue graphicsQueue;//be able to present image
     vk::CommandPool commandPool;
+    PipelineCache pipelineCache;//same on-disk cache the compute context uses
 
     vk::Format depthImageFormat;
     std::vector<vk::Image> depthImages;
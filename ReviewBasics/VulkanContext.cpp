@@ -25,7 +25,7 @@ void VulkanContext::destroy()
 
 uint32_t VulkanContext::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties)
 {
-    vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+    const vk::PhysicalDeviceMemoryProperties& memoryProperties = deviceInfo.memoryProperties;
     for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
     {
         bool memoryTypeSupport = typeFilter & (1 << i);
@@ -123,27 +123,43 @@ void VulkanContext::setupDebugMessenger()
     }
 }
 
-void VulkanContext::selectPhysicalDevice()
+//a graphics family that presents to the surface, the swapchain and the anisotropic sampler of VulkanApp
+DeviceSelector::Requirements VulkanContext::deviceRequirements()const
 {
-    auto physicalDevices = instance.enumeratePhysicalDevices();
-    for (const auto& i : physicalDevices)
+    DeviceSelector::Requirements requirements;
+    requirements.queueFlags = vk::QueueFlagBits::eGraphics;
+    requirements.extensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+    vk::SurfaceKHR windowSurface = surface;
+    requirements.check = [windowSurface](const DeviceInfo& device)->std::string
     {
-        auto features = i.getFeatures();
-        auto properties = i.getProperties();
-        if (properties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu && features.geometryShader)
+        if (!device.features.samplerAnisotropy)
         {
-            physicalDevice = i;
+            return "no samplerAnisotropy";
         }
-    }
+        for (uint32_t i = 0; i < device.queueFamilies.size(); i++)
+        {
+            if ((device.queueFamilies[i].queueFlags & vk::QueueFlagBits::eGraphics) && device.handle.getSurfaceSupportKHR(i, windowSurface))
+            {
+                return {};
+            }
+        }
+        return "can't present to the window";
+    };
+    return requirements;
+}
+
+void VulkanContext::selectPhysicalDevice()
+{
+    deviceInfo = DeviceSelector::select(instance, VK_API_VERSION_1_0, deviceRequirements());
+    physicalDevice = deviceInfo.handle;
 }
 
 void VulkanContext::selectQueueFamily()
 {
-    auto queueFamilyProperties = physicalDevice.getQueueFamilyProperties();
     uint32_t index = 0;
-    for (const auto& i : queueFamilyProperties)
+    for (const auto& i : deviceInfo.queueFamilies)
     {
-        if (i.queueFlags | vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eTransfer)
+        if (i.queueFlags & vk::QueueFlagBits::eGraphics)
         {
             if (physicalDevice.getSurfaceSupportKHR(index, surface))
             {
@@ -1,6 +1,7 @@
 #pragma once
 #include<vulkan/vulkan.hpp>
 #include"NativeWindow.h"
+#include"DeviceSelector.h"
 class VulkanContext
 {
 public:
@@ -23,16 +24,20 @@ public:
 
     uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties);
     vk::Format findSupportedFormat(const std::vector<vk::Format>& candidates, vk::ImageTiling tiling, vk::FormatFeatureFlags features);
-    inline vk::PhysicalDeviceProperties getPhysicalDeviceProperties() { return physicalDevice.getProperties(); };
+    inline const vk::PhysicalDeviceProperties& getPhysicalDeviceProperties()const { return deviceInfo.properties; };
+    inline const DeviceInfo& getDeviceInfo()const { return deviceInfo; }
 private:
     vk::Instance instance;
     vk::PhysicalDevice physicalDevice;
+    //cached at selection, findMemoryType and the properties getter never query the driver
+    DeviceInfo deviceInfo;
     uint32_t queueFamilyIndex = -1;
     vk::DebugUtilsMessengerCreateInfoEXT debugMessengerCreateInfo;
     vk::DebugUtilsMessengerEXT debugMessenger;
     vk::SurfaceKHR surface;
 
     void fillDebugMessengerCreateInfo();
+    DeviceSelector::Requirements deviceRequirements()const;
 
 #ifdef NDEBUG
     const bool enableValidationLayers = false;
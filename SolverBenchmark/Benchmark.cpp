@@ -0,0 +1,435 @@
+#include<iostream>
+#include<fstream>
+#include<chrono>
+#include<algorithm>
+#include<functional>
+#include<memory>
+#include<string>
+#include<vector>
+#include<armadillo>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"SparseSolver.h"
+#include"CgSolver.h"
+#include"MixedPrecisionSolver.h"
+#include"BatchedSolver.h"
+#include"CpuSolver.h"
+#include"MyComputeProgram.h"
+#include"TestProblems.h"
+
+//sweeps every solver over growing dense and sparse systems and batches of small systems, and writes one row per run,
+//usage: SolverBenchmark [report.csv|report.json] [max n]
+
+using Clock = std::chrono::steady_clock;
+
+struct BenchmarkCase
+{
+    std::string family;
+    arma::sp_mat matA;
+    //the dense family keeps A dense too, solvers with dense storage take it as it is
+    arma::mat denseA;
+};
+
+struct BenchmarkSolver
+{
+    std::string name;
+    std::function<std::unique_ptr<LinearSolver>()> create;
+    //solves the case again with timestamps on and returns the mean gpu milliseconds of an iteration, empty for solvers without timestamps
+    std::function<double(const BenchmarkCase&, const arma::vec&)> timeOnGpu;
+    //keeps a dense A as dense rows, an iteration reads 8 bytes per element instead of 12 per nonzero
+    bool denseStorage = false;
+    //skips the sparse family, whose larger grids don't fit as dense matrices
+    bool denseOnly = false;
+};
+
+struct BenchmarkResult
+{
+    std::string family;
+    std::string solver;
+    arma::uword n = 0;
+    arma::uword systems = 1;
+    arma::uword nonzeros = 0;
+    double setupSeconds = 0.0;
+    double uploadSeconds = 0.0;
+    int iterations = 0;
+    bool converged = false;
+    double perIterationMs = 0.0;
+    //0 when the solver has no timestamps
+    double gpuIterationMs = 0.0;
+    double gigabytesPerSecond = 0.0;
+    double gigaflopsPerSecond = 0.0;
+    double timeToToleranceSeconds = 0.0;
+};
+
+//jacobi.comp of the dense demo behind the LinearSolver interface, A is stored row major so consecutive lanes read consecutive doubles
+class DenseJacobiSolver :public LinearSolver
+{
+    MyComputeProgram program;
+public:
+    DenseJacobiSolver()
+    {
+        program.setMatrixLayout(MyComputeProgram::MatrixLayout::eRowMajor);
+    }
+
+    void init(const arma::sp_mat& matA, const arma::vec& b) override
+    {
+        init(arma::mat(matA), b);
+    }
+
+    void init(const arma::mat& matA, const arma::vec& b) override
+    {
+        program.setSystem(matA, b);
+        program.init();
+    }
+
+    arma::vec run() override
+    {
+        report.iterations = program.run();
+        report.converged = program.getStatus().converged != 0;
+        return program.getResult().col(0);
+    }
+
+    void destroy() override
+    {
+        program.destroy();
+    }
+
+    void enableTimestamps()
+    {
+        program.enableTimestamps();
+    }
+
+    const std::vector<TimestampRecord>& getTimestampRecords()const
+    {
+        return program.getTimestampRecords();
+    }
+};
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+std::vector<BenchmarkCase> createCases(arma::uword maxN)
+{
+    std::vector<BenchmarkCase> cases;
+    for (arma::uword n : { 10, 32, 100, 316, 1000, 2048 })
+    {
+        if (n <= maxN)
+        {
+            //a shift of n keeps the Jacobi contraction near 1/3 at every size, so Jacobi and CG both converge quickly
+            arma::mat denseA = createSymmetricDenseMatrix(n, static_cast<double>(n));
+            cases.push_back({ "dense", arma::sp_mat(denseA), denseA });
+        }
+    }
+    for (arma::uword gridSize : { 4, 8, 16, 32, 64, 128, 256 })
+    {
+        if (gridSize * gridSize <= maxN)
+        {
+            cases.push_back({ "sparse", createPoissonMatrix(gridSize), arma::mat() });
+        }
+    }
+    return cases;
+}
+
+void initSolver(LinearSolver& solver, const BenchmarkCase& benchmarkCase, const arma::vec& b, bool denseStorage)
+{
+    if (denseStorage && !benchmarkCase.denseA.is_empty())
+    {
+        solver.init(benchmarkCase.denseA, b);
+    }
+    else
+    {
+        solver.init(benchmarkCase.matA, b);
+    }
+}
+
+//gpu time of a solve divided by its iterations, every timed section of an iteration counts
+double meanIterationMs(const std::vector<TimestampRecord>& records)
+{
+    double total = 0.0;
+    int iterations = 0;
+    for (size_t k = 0; k < records.size(); k++)
+    {
+        total += records[k].gpuMilliseconds;
+        if (k == 0 || records[k].batch != records[k - 1].batch || records[k].iteration != records[k - 1].iteration)
+        {
+            iterations++;
+        }
+    }
+    return iterations > 0 ? total / iterations : 0.0;
+}
+
+//timed batches run one at a time and fit the query pool, so the timestamps come from a second solve
+//and the wall clock solve keeps its usual batching
+template<typename Solver>
+BenchmarkSolver timedSolver(const std::string& name, std::function<std::unique_ptr<Solver>()> create, bool denseStorage = false, bool denseOnly = false)
+{
+    BenchmarkSolver benchmarkSolver;
+    benchmarkSolver.name = name;
+    benchmarkSolver.create = [create]() { return std::unique_ptr<LinearSolver>(create()); };
+    benchmarkSolver.timeOnGpu = [create, denseStorage](const BenchmarkCase& benchmarkCase, const arma::vec& b)
+    {
+        std::unique_ptr<Solver> solver = create();
+        solver->enableTimestamps();
+        initSolver(*solver, benchmarkCase, b, denseStorage);
+        solver->run();
+        solver->destroy();
+        return meanIterationMs(solver->getTimestampRecords());
+    };
+    benchmarkSolver.denseStorage = denseStorage;
+    benchmarkSolver.denseOnly = denseOnly;
+    return benchmarkSolver;
+}
+
+std::vector<BenchmarkSolver> createSolvers()
+{
+    auto sparseSolver = [](SparseSolver::Method method, double omega)
+    {
+        return std::function<std::unique_ptr<SparseSolver>()>([method, omega]()
+            {
+                std::unique_ptr<SparseSolver> solver(new SparseSolver);
+                solver->setMethod(method);
+                solver->setRelaxation(omega);
+                return solver;
+            });
+    };
+    auto cpuSolver = [](CpuSolver::Method method)
+    {
+        return [method]() { return std::unique_ptr<LinearSolver>(new CpuSolver(method)); };
+    };
+    return {
+        timedSolver<SparseSolver>("gpu-jacobi", sparseSolver(SparseSolver::Method::eJacobi, 1.0)),
+        timedSolver<SparseSolver>("gpu-gauss-seidel", sparseSolver(SparseSolver::Method::eGaussSeidel, 1.0)),
+        timedSolver<SparseSolver>("gpu-sor", sparseSolver(SparseSolver::Method::eMulticolorGaussSeidel, 1.5)),
+        timedSolver<CgSolver>("gpu-cg", []() { return std::unique_ptr<CgSolver>(new CgSolver); }),
+        timedSolver<MixedPrecisionSolver>("gpu-mixed", []() { return std::unique_ptr<MixedPrecisionSolver>(new MixedPrecisionSolver); }),
+        timedSolver<DenseJacobiSolver>("gpu-dense-jacobi", []() { return std::unique_ptr<DenseJacobiSolver>(new DenseJacobiSolver); }, true, true),
+        { "cpu-jacobi", cpuSolver(CpuSolver::Method::eJacobi), {}, true, false },
+        { "cpu-gauss-seidel", cpuSolver(CpuSolver::Method::eGaussSeidel), {}, true, false },
+        { "cpu-cg", cpuSolver(CpuSolver::Method::eConjugateGradient), {}, true, false } };
+}
+
+//bandwidth and flops of one iteration, from the gpu time when there is one so they describe the kernels alone
+void fillRates(BenchmarkResult& result, double bytesPerIteration, double flopsPerIteration)
+{
+    if (result.iterations <= 0)
+    {
+        return;
+    }
+    double perIteration = result.timeToToleranceSeconds / result.iterations;
+    result.perIterationMs = perIteration * 1e3;
+    if (result.gpuIterationMs > 0.0)
+    {
+        perIteration = result.gpuIterationMs * 1e-3;
+    }
+    result.gigabytesPerSecond = bytesPerIteration / perIteration * 1e-9;
+    result.gigaflopsPerSecond = flopsPerIteration / perIteration * 1e-9;
+}
+
+//construction is the setup (instance, device, thread pool), init is the upload,
+//run is the time to tolerance since every solver runs until converged or out of iterations
+BenchmarkResult runCase(const BenchmarkCase& benchmarkCase, const BenchmarkSolver& benchmarkSolver)
+{
+    const arma::sp_mat& A = benchmarkCase.matA;
+    arma::vec solutionX(A.n_rows, arma::fill::randu);
+    arma::vec b = A * solutionX;
+
+    BenchmarkResult result;
+    result.family = benchmarkCase.family;
+    result.solver = benchmarkSolver.name;
+    result.n = A.n_rows;
+    result.nonzeros = A.n_nonzero;
+
+    auto start = Clock::now();
+    std::unique_ptr<LinearSolver> solver = benchmarkSolver.create();
+    result.setupSeconds = secondsSince(start);
+
+    start = Clock::now();
+    initSolver(*solver, benchmarkCase, b, benchmarkSolver.denseStorage);
+    result.uploadSeconds = secondsSince(start);
+
+    start = Clock::now();
+    solver->run();
+    result.timeToToleranceSeconds = secondsSince(start);
+    solver->destroy();
+
+    result.iterations = solver->getReport().iterations;
+    result.converged = solver->getReport().converged;
+    if (benchmarkSolver.timeOnGpu)
+    {
+        try
+        {
+            result.gpuIterationMs = benchmarkSolver.timeOnGpu(benchmarkCase, b);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << fmt::format("{} {} n = {}: no gpu timestamps, {}\n", benchmarkCase.family, benchmarkSolver.name, A.n_rows, e.what());
+        }
+    }
+
+    //one sweep over A plus reading b, x and writing x, CSR reads a double value and a 32 bit column per nonzero
+    double n = static_cast<double>(A.n_rows);
+    bool dense = benchmarkSolver.denseStorage && !benchmarkCase.denseA.is_empty();
+    double bytes = (dense ? 8.0 * n * n : 12.0 * A.n_nonzero + 4.0 * n) + 3.0 * 8.0 * n;
+    double flops = 2.0 * (dense ? n * n : A.n_nonzero);
+    fillRates(result, bytes, flops);
+    return result;
+}
+
+//systemCount random diagonally dominant n x n systems in one submission, n is the size of one system
+BenchmarkResult runBatchedCase(arma::uword n, arma::uword systemCount)
+{
+    arma::cube A(n, n, systemCount, arma::fill::randu);
+    arma::mat solutionX(n, systemCount, arma::fill::randu);
+    arma::mat b(n, systemCount);
+    for (arma::uword s = 0; s < systemCount; s++)
+    {
+        A.slice(s).diag() += arma::sum(A.slice(s), 1) + 3.0;
+        b.col(s) = A.slice(s) * solutionX.col(s);
+    }
+
+    BenchmarkResult result;
+    result.family = "batched";
+    result.solver = "gpu-batched";
+    result.n = n;
+    result.systems = systemCount;
+    result.nonzeros = A.n_elem;
+
+    auto start = Clock::now();
+    BatchedSolver solver;
+    result.setupSeconds = secondsSince(start);
+    //one submission either way, so the timed solve is the measured one
+    try
+    {
+        solver.enableTimestamps();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << fmt::format("batched n = {}, {} systems: no gpu timestamps, {}\n", n, systemCount, e.what());
+    }
+
+    start = Clock::now();
+    solver.init(A, b);
+    result.uploadSeconds = secondsSince(start);
+
+    start = Clock::now();
+    solver.run();
+    result.timeToToleranceSeconds = secondsSince(start);
+    solver.destroy();
+
+    //the systems stop on their own, the slowest one sets the length of the dispatch
+    result.converged = true;
+    for (const auto& i : solver.getSystemStatus())
+    {
+        result.iterations = std::max(result.iterations, static_cast<int>(i.iterations));
+        result.converged = result.converged && i.converged != 0;
+    }
+    double gpuMilliseconds = 0.0;
+    for (const auto& i : solver.getTimestampRecords())
+    {
+        gpuMilliseconds += i.gpuMilliseconds;
+    }
+    if (result.iterations > 0)
+    {
+        result.gpuIterationMs = gpuMilliseconds / result.iterations;
+    }
+    double systems = static_cast<double>(systemCount);
+    double elements = static_cast<double>(n) * n;
+    fillRates(result, systems * (8.0 * elements + 3.0 * 8.0 * n), systems * 2.0 * elements);
+    return result;
+}
+
+void writeCsv(std::ostream& out, const std::vector<BenchmarkResult>& results)
+{
+    out << "family,solver,n,systems,nnz,setup_s,upload_s,iterations,converged,per_iter_ms,gpu_iter_ms,gbps,gflops,time_to_tolerance_s\n";
+    for (const auto& i : results)
+    {
+        out << fmt::format("{},{},{},{},{},{:.6f},{:.6f},{},{},{:.6f},{:.6f},{:.3f},{:.3f},{:.6f}\n",
+            i.family, i.solver, i.n, i.systems, i.nonzeros, i.setupSeconds, i.uploadSeconds, i.iterations, i.converged ? 1 : 0,
+            i.perIterationMs, i.gpuIterationMs, i.gigabytesPerSecond, i.gigaflopsPerSecond, i.timeToToleranceSeconds);
+    }
+}
+
+void writeJson(std::ostream& out, const std::vector<BenchmarkResult>& results)
+{
+    out << "[\n";
+    for (size_t k = 0; k < results.size(); k++)
+    {
+        const auto& i = results[k];
+        out << fmt::format("  {{\"family\": \"{}\", \"solver\": \"{}\", \"n\": {}, \"systems\": {}, \"nnz\": {}, \"setup_s\": {:.6f}, \"upload_s\": {:.6f}, "
+            "\"iterations\": {}, \"converged\": {}, \"per_iter_ms\": {:.6f}, \"gpu_iter_ms\": {:.6f}, \"gbps\": {:.3f}, \"gflops\": {:.3f}, \"time_to_tolerance_s\": {:.6f}}}{}\n",
+            i.family, i.solver, i.n, i.systems, i.nonzeros, i.setupSeconds, i.uploadSeconds, i.iterations, i.converged ? "true" : "false",
+            i.perIterationMs, i.gpuIterationMs, i.gigabytesPerSecond, i.gigaflopsPerSecond, i.timeToToleranceSeconds, k + 1 < results.size() ? "," : "");
+    }
+    out << "]\n";
+}
+
+int main(int argc, char** argv)
+{
+    std::string reportPath = argc > 1 ? argv[1] : "benchmark.csv";
+    arma::uword maxN = argc > 2 ? std::stoul(argv[2]) : 65536;
+
+    //headless runs (lavapipe in CI) usually come without the validation layer
+    SimpleComputeContext::validationEnabled() = false;
+    arma::arma_rng::set_seed(42);
+
+    std::vector<BenchmarkResult> results;
+    std::vector<BenchmarkCase> cases = createCases(maxN);
+    std::vector<BenchmarkSolver> solvers = createSolvers();
+    for (const auto& benchmarkCase : cases)
+    {
+        for (const auto& benchmarkSolver : solvers)
+        {
+            if (benchmarkSolver.denseOnly && benchmarkCase.denseA.is_empty())
+            {
+                continue;
+            }
+            try
+            {
+                results.push_back(runCase(benchmarkCase, benchmarkSolver));
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << fmt::format("{} {} n = {}: {}\n", benchmarkCase.family, benchmarkSolver.name, benchmarkCase.matA.n_rows, e.what());
+            }
+        }
+    }
+    //the unknowns of a whole batch are bounded by max n like a single system
+    for (arma::uword n : { 8, 16, 32 })
+    {
+        for (arma::uword systemCount : { 256, 4096, 65536 })
+        {
+            if (n * systemCount > maxN)
+            {
+                continue;
+            }
+            try
+            {
+                results.push_back(runBatchedCase(n, systemCount));
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << fmt::format("batched n = {}, {} systems: {}\n", n, systemCount, e.what());
+            }
+        }
+    }
+
+    std::ofstream report(reportPath);
+    if (!report.is_open())
+    {
+        std::cerr << "can't open " << reportPath << '\n';
+        return 1;
+    }
+    bool json = reportPath.size() >= 5 && reportPath.compare(reportPath.size() - 5, 5, ".json") == 0;
+    if (json)
+    {
+        writeJson(report, results);
+    }
+    else
+    {
+        writeCsv(report, results);
+    }
+    std::cout << fmt::format("{} runs written to {}\n", results.size(), reportPath);
+    return 0;
+}
@@ -0,0 +1,160 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<array>
+#include<limits>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+
+//matches SystemStatus in batchedJacobi.comp
+struct BatchStatus
+{
+    uint32_t converged;
+    uint32_t iterations;
+    double updateNorm;
+};
+
+//solves a stack of small independent systems with one Jacobi workgroup each,
+//all systems share one Vulkan setup and one submission
+class BatchedSolver :protected SimpleComputeContext
+{
+public:
+    struct PushConstants
+    {
+        int32_t n;
+        int32_t maxIterations;
+        int32_t systemOffset;
+        int32_t padding;
+        double tolerance;
+    };
+private:
+    uint32_t n = 0;
+    uint32_t systemCount = 0;
+
+    vk::Buffer matricesBuffer;
+    vk::DeviceMemory matricesBufferMemory;
+    vk::Buffer vectorsBBuffer;
+    vk::DeviceMemory vectorsBBufferMemory;
+    vk::Buffer vectorsXBuffer;
+    vk::DeviceMemory vectorsXBufferMemory;
+    vk::Buffer statusBuffer;
+    vk::DeviceMemory statusBufferMemory;
+
+    ComputeKernel kernel;
+    vk::Pipeline computePipeline;
+    std::vector<KernelArg> args;
+
+    std::vector<BatchStatus> systemStatus;
+    uint32_t workGroupSize = 1;
+    int maxIterations = 0;
+    double tolerance = 1e-10;
+
+    std::tuple<vk::Buffer, vk::DeviceMemory> sendToGPU(const void* data, vk::DeviceSize size)
+    {
+        auto result = createStorageBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer);
+        uploadToBuffer(std::get<0>(result), std::get<1>(result), data, size);
+        return result;
+    }
+public:
+    using SimpleComputeContext::MemoryPolicy;
+    using SimpleComputeContext::setMemoryPolicy;
+    using SimpleComputeContext::enableTimestamps;
+    using SimpleComputeContext::getTimestampRecords;
+    using SimpleComputeContext::printTimestampLog;
+
+    //largest change of any unknown of one system between two iterates that counts as converged
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    //upper bound on the iterations of every system, 0 uses 5 * n like the dense solver
+    void setMaxIterations(int iterations)
+    {
+        maxIterations = iterations;
+    }
+
+    //slice s of matrices and column s of vectorsB form system s
+    void init(const arma::cube& matrices, const arma::mat& vectorsB)
+    {
+        if (matrices.n_rows != matrices.n_cols || matrices.n_rows != vectorsB.n_rows || matrices.n_slices != vectorsB.n_cols)
+        {
+            throw std::runtime_error("batched solver needs square matrices matching the columns of b");
+        }
+        if (matrices.n_elem > std::numeric_limits<uint32_t>::max() || 2 * vectorsB.n_elem > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::runtime_error("batch too large for 32 bit indices");
+        }
+        n = static_cast<uint32_t>(matrices.n_rows);
+        systemCount = static_cast<uint32_t>(matrices.n_slices);
+
+        std::tie(matricesBuffer, matricesBufferMemory) = sendToGPU(matrices.memptr(), matrices.n_elem * sizeof(double));
+        std::tie(vectorsBBuffer, vectorsBBufferMemory) = sendToGPU(vectorsB.memptr(), vectorsB.n_elem * sizeof(double));
+        std::tie(vectorsXBuffer, vectorsXBufferMemory) = createStorageBuffer(2 * vectorsB.n_elem * sizeof(double), vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(statusBuffer, statusBufferMemory) = createStorageBuffer(systemCount * sizeof(BatchStatus), vk::BufferUsageFlagBits::eStorageBuffer);
+
+        workGroupSize = chooseWorkGroupSize(n);
+        kernel.init(*this, "./shaders/batchedJacobi.spv");
+        computePipeline = kernel.pipeline(workGroupSize);
+        args = { kernelArg<double>(matricesBuffer), kernelArg<double>(vectorsBBuffer), kernelArg<double>(vectorsXBuffer), kernelArg<BatchStatus>(statusBuffer) };
+    }
+
+    //returns the solutions as the columns of an n x systemCount matrix
+    arma::mat run()
+    {
+        int calcIterations = maxIterations > 0 ? maxIterations : 5 * static_cast<int>(n);
+        PushConstants pushConst{ static_cast<int32_t>(n), calcIterations, 0, 0, tolerance };
+        //one workgroup per system, split into several dispatches when the batch exceeds the group count limit
+        uint32_t maxGroupCount = deviceInfo.properties.limits.maxComputeWorkGroupCount[0];
+        uint32_t dispatchCount = (systemCount + maxGroupCount - 1) / maxGroupCount;
+
+        //the iterations run inside the kernel, timed it records one section per dispatch
+        if (timestampsEnabled())
+        {
+            timestampGroupsPerBatch(dispatchCount);
+        }
+        vk::CommandBuffer command = beginSingleTimeCommand();
+        beginTimestamps(command);
+        for (uint32_t offset = 0; offset < systemCount; offset += maxGroupCount)
+        {
+            pushConst.systemOffset = static_cast<int32_t>(offset);
+            kernel.record(command, computePipeline, args, pushConst, std::min(maxGroupCount, systemCount - offset));
+            writeTimestamp(command, static_cast<int>(offset / maxGroupCount), "systems");
+        }
+        vk::MemoryBarrier computeToHost(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, computeToHost, {}, {});
+        endSingleTimeCommand(command);
+        if (timestampsEnabled())
+        {
+            collectTimestamps(std::numeric_limits<double>::quiet_NaN());
+        }
+
+        systemStatus.resize(systemCount);
+        readbackFromBuffer(statusBuffer, statusBufferMemory, systemStatus.data(), systemCount * sizeof(BatchStatus));
+        arma::mat iterates(2 * n, systemCount);
+        readbackFromBuffer(vectorsXBuffer, vectorsXBufferMemory, iterates.memptr(), iterates.n_elem * sizeof(double));
+
+        uint32_t convergedCount = 0;
+        uint32_t mostIterations = 0;
+        for (const auto& i : systemStatus)
+        {
+            convergedCount += i.converged;
+            mostIterations = std::max(mostIterations, i.iterations);
+        }
+        fmt::print("batched jacobi: {} of {} systems converged, at most {} iterations\n", convergedCount, systemCount, mostIterations);
+        return iterates.rows(0, n - 1);
+    }
+
+    //convergence of every system from the last run
+    inline const std::vector<BatchStatus>& getSystemStatus()const { return systemStatus; }
+
+    void destroy()
+    {
+        destroyBufferAndFreeMemory(matricesBuffer, matricesBufferMemory);
+        destroyBufferAndFreeMemory(vectorsBBuffer, vectorsBBufferMemory);
+        destroyBufferAndFreeMemory(vectorsXBuffer, vectorsXBufferMemory);
+        destroyBufferAndFreeMemory(statusBuffer, statusBufferMemory);
+        kernel.destroy();
+    }
+};
@@ -0,0 +1,252 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<array>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+#include"CsrMatrix.h"
+#include"LinearSolver.h"
+
+//matches CgStatus in the cg shaders, starts with the indirect dispatch of the vector kernels
+struct CgStatus
+{
+    vk::DispatchIndirectCommand iterationDispatch;
+    uint32_t converged;
+    double residualNorm;
+    uint32_t iterations;
+    double rr;
+    double alpha;
+    double beta;
+    double toleranceSquared;
+};
+
+//conjugate gradient for symmetric positive definite systems, vectors and scalars never leave the GPU,
+//the host only polls the converged flag between batches
+class CgSolver :public LinearSolver, protected SimpleComputeContext
+{
+public:
+    struct PushConstants
+    {
+        int32_t nRows;
+        int32_t partialCount;
+        int32_t stage;
+    };
+private:
+    CsrMatrix A;
+
+    vk::Buffer rowPtrBuffer;
+    vk::DeviceMemory rowPtrBufferMemory;
+    vk::Buffer colIdxBuffer;
+    vk::DeviceMemory colIdxBufferMemory;
+    vk::Buffer valuesBuffer;
+    vk::DeviceMemory valuesBufferMemory;
+
+    //x, r, p and Ap
+    std::array<vk::Buffer, 4> vectorBuffers;
+    std::array<vk::DeviceMemory, 4> vectorBufferMemorys;
+    //one dot product part per workgroup
+    vk::Buffer partialsBuffer;
+    vk::DeviceMemory partialsBufferMemory;
+    vk::Buffer statusBuffer;
+    vk::DeviceMemory statusBufferMemory;
+
+    //the kernels share binding numbers, each one only declares the buffers it touches
+    ComputeKernel spmvKernel;
+    ComputeKernel reduceKernel;
+    ComputeKernel updateSolutionKernel;
+    ComputeKernel updateDirectionKernel;
+    vk::Pipeline spmvPipeline;
+    vk::Pipeline reducePipeline;
+    vk::Pipeline updateSolutionPipeline;
+    vk::Pipeline updateDirectionPipeline;
+    std::vector<KernelArg> spmvArgs;
+    std::vector<KernelArg> reduceArgs;
+    std::vector<KernelArg> updateSolutionArgs;
+    std::vector<KernelArg> updateDirectionArgs;
+    vk::CommandBuffer batchCommandBuffer;
+
+    uint32_t workGroupSize = 1;
+    uint32_t groupCount = 1;
+    int maxIterations = 0;
+    int iterationsPerBatch = 0;
+    int batchCount = 1;
+    double tolerance = 1e-10;
+
+    std::tuple<vk::Buffer, vk::DeviceMemory> sendToGPU(const void* data, vk::DeviceSize size)
+    {
+        auto result = createStorageBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer);
+        uploadToBufferAsync(std::get<0>(result), std::get<1>(result), data, size);
+        return result;
+    }
+
+    void recordIteration(int iteration)
+    {
+        PushConstants pushConst{ static_cast<int32_t>(A.n_rows), static_cast<int32_t>(groupCount), 0 };
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        vk::MemoryBarrier checkToIteration(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eIndirectCommandRead);
+        auto computeBarrier = [&]()
+        {
+            batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+        };
+
+        spmvKernel.recordIndirect(batchCommandBuffer, spmvPipeline, spmvArgs, pushConst, statusBuffer);
+        computeBarrier();
+        writeTimestamp(batchCommandBuffer, iteration, "spmv");
+
+        reduceKernel.record(batchCommandBuffer, reducePipeline, reduceArgs, pushConst, 1);
+        computeBarrier();
+        writeTimestamp(batchCommandBuffer, iteration, "alpha");
+
+        updateSolutionKernel.recordIndirect(batchCommandBuffer, updateSolutionPipeline, updateSolutionArgs, pushConst, statusBuffer);
+        computeBarrier();
+        writeTimestamp(batchCommandBuffer, iteration, "update x r");
+
+        pushConst.stage = 1;
+        reduceKernel.record(batchCommandBuffer, reducePipeline, reduceArgs, pushConst, 1);
+        //also orders the first dispatch of the next submitted batch
+        batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect, {}, checkToIteration, {}, {});
+        writeTimestamp(batchCommandBuffer, iteration, "beta");
+
+        updateDirectionKernel.recordIndirect(batchCommandBuffer, updateDirectionPipeline, updateDirectionArgs, pushConst, statusBuffer);
+        computeBarrier();
+        writeTimestamp(batchCommandBuffer, iteration, "update p");
+    }
+public:
+    using SimpleComputeContext::MemoryPolicy;
+    using SimpleComputeContext::setMemoryPolicy;
+    using SimpleComputeContext::enableTimestamps;
+    using SimpleComputeContext::getTimestampRecords;
+    using SimpleComputeContext::printTimestampLog;
+
+    //iterations recorded into one command buffer, 0 records every iteration into a single submission
+    void setIterationsPerBatch(int iterations)
+    {
+        iterationsPerBatch = iterations;
+    }
+
+    //stops once norm(b - A * x) <= tolerance * norm(b)
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    //upper bound on the number of iterations, 0 uses n which is enough in exact arithmetic
+    void setMaxIterations(int iterations)
+    {
+        maxIterations = iterations;
+    }
+
+    using LinearSolver::init;
+
+    void init(const arma::sp_mat& matA, const arma::vec& b) override
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != b.n_elem)
+        {
+            throw std::runtime_error("cg solver needs a square matrix matching b");
+        }
+        A = CsrMatrix::fromArma(matA);
+
+        workGroupSize = chooseWorkGroupSize(A.n_rows);
+        groupCount = (A.n_rows + workGroupSize - 1) / workGroupSize;
+
+        //x0 = 0 so r0 = p0 = b
+        arma::vec zeros(b.n_elem, arma::fill::zeros);
+        vk::DeviceSize sizeOfx = b.n_elem * sizeof(double);
+        std::tie(rowPtrBuffer, rowPtrBufferMemory) = sendToGPU(A.rowPtr.data(), A.rowPtr.size() * sizeof(uint32_t));
+        std::tie(colIdxBuffer, colIdxBufferMemory) = sendToGPU(A.colIdx.data(), A.colIdx.size() * sizeof(uint32_t));
+        std::tie(valuesBuffer, valuesBufferMemory) = sendToGPU(A.values.data(), A.values.size() * sizeof(double));
+        std::tie(vectorBuffers[0], vectorBufferMemorys[0]) = sendToGPU(zeros.memptr(), sizeOfx);
+        std::tie(vectorBuffers[1], vectorBufferMemorys[1]) = sendToGPU(b.memptr(), sizeOfx);
+        std::tie(vectorBuffers[2], vectorBufferMemorys[2]) = sendToGPU(b.memptr(), sizeOfx);
+        std::tie(vectorBuffers[3], vectorBufferMemorys[3]) = createStorageBuffer(sizeOfx, vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(partialsBuffer, partialsBufferMemory) = createStorageBuffer(groupCount * sizeof(double), vk::BufferUsageFlagBits::eStorageBuffer);
+
+        double rr = arma::dot(b, b);
+        double toleranceSquared = tolerance * tolerance * rr;
+        uint32_t converged = rr <= toleranceSquared ? 1 : 0;
+        CgStatus initialStatus{ { converged ? 0 : groupCount, 1, 1 }, converged, std::sqrt(rr), 0, rr, 0.0, 0.0, toleranceSquared };
+        std::tie(statusBuffer, statusBufferMemory) = createHostBuffer(sizeof(CgStatus), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+        void* statusPtr = device.mapMemory(statusBufferMemory, 0, sizeof(CgStatus));
+        memcpy(statusPtr, &initialStatus, sizeof(CgStatus));
+        device.unmapMemory(statusBufferMemory);
+
+        spmvKernel.init(*this, "./shaders/cgSpmv.spv");
+        reduceKernel.init(*this, "./shaders/cgReduce.spv");
+        updateSolutionKernel.init(*this, "./shaders/cgUpdateSolution.spv");
+        updateDirectionKernel.init(*this, "./shaders/cgUpdateDirection.spv");
+        spmvPipeline = spmvKernel.pipeline(workGroupSize);
+        reducePipeline = reduceKernel.pipeline(workGroupSize);
+        updateSolutionPipeline = updateSolutionKernel.pipeline(workGroupSize);
+        updateDirectionPipeline = updateDirectionKernel.pipeline(workGroupSize);
+
+        KernelArg x = kernelArg<double>(vectorBuffers[0]);
+        KernelArg r = kernelArg<double>(vectorBuffers[1]);
+        KernelArg p = kernelArg<double>(vectorBuffers[2]);
+        KernelArg ap = kernelArg<double>(vectorBuffers[3]);
+        KernelArg partials = kernelArg<double>(partialsBuffer);
+        KernelArg status = kernelArg<CgStatus>(statusBuffer);
+        spmvArgs = { kernelArg<uint32_t>(rowPtrBuffer), kernelArg<uint32_t>(colIdxBuffer), kernelArg<double>(valuesBuffer), p, ap, partials };
+        reduceArgs = { partials, status };
+        updateSolutionArgs = { x, r, p, ap, partials, status };
+        updateDirectionArgs = { r, p, status };
+
+        int calcIterations = maxIterations > 0 ? maxIterations : static_cast<int>(A.n_rows);
+        if (iterationsPerBatch <= 0 || iterationsPerBatch > calcIterations)
+        {
+            iterationsPerBatch = calcIterations;
+        }
+        if (timestampsEnabled())
+        {
+            //five kernels, five timestamps per iteration
+            iterationsPerBatch = std::min(iterationsPerBatch, timestampGroupsPerBatch(5));
+        }
+        batchCount = (calcIterations + iterationsPerBatch - 1) / iterationsPerBatch;
+
+        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        batchCommandBuffer = device.allocateCommandBuffers(commandAllocInfo).front();
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+        batchCommandBuffer.begin(beginInfo);
+        beginTimestamps(batchCommandBuffer);
+        for (int i = 0; i < iterationsPerBatch; i++)
+        {
+            recordIteration(i);
+        }
+        vk::MemoryBarrier computeToHost(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, computeToHost, {}, {});
+        batchCommandBuffer.end();
+    }
+
+    arma::vec run() override
+    {
+        const CgStatus* status = static_cast<const CgStatus*>(device.mapMemory(statusBufferMemory, 0, sizeof(CgStatus)));
+        submitBatchesUntil(batchCommandBuffer, batchCount, &status->converged, &status->residualNorm);
+        report.iterations = status->iterations;
+        report.converged = status->converged != 0;
+        fmt::print("cg {} after {} iterations, residual norm {:e}\n",
+            status->converged ? "converged" : "did not converge", status->iterations, status->residualNorm);
+        device.unmapMemory(statusBufferMemory);
+
+        arma::vec result(A.n_rows);
+        readbackFromBuffer(vectorBuffers[0], vectorBufferMemorys[0], result.memptr(), A.n_rows * sizeof(double));
+        return result;
+    }
+
+    void destroy() override
+    {
+        destroyBufferAndFreeMemory(rowPtrBuffer, rowPtrBufferMemory);
+        destroyBufferAndFreeMemory(colIdxBuffer, colIdxBufferMemory);
+        destroyBufferAndFreeMemory(valuesBuffer, valuesBufferMemory);
+        for (size_t i = 0; i < vectorBuffers.size(); i++)
+        {
+            destroyBufferAndFreeMemory(vectorBuffers[i], vectorBufferMemorys[i]);
+        }
+        destroyBufferAndFreeMemory(partialsBuffer, partialsBufferMemory);
+        destroyBufferAndFreeMemory(statusBuffer, statusBufferMemory);
+        spmvKernel.destroy();
+        reduceKernel.destroy();
+        updateSolutionKernel.destroy();
+        updateDirectionKernel.destroy();
+        device.freeCommandBuffers(commandPool, batchCommandBuffer);
+    }
+};
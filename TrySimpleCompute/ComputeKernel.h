@@ -0,0 +1,559 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<algorithm>
+#include<functional>
+#include<map>
+#include<string>
+#include<unordered_map>
+#include<vector>
+#include"SimpleComputeContext.h"
+
+//scalar type of the runtime array that ends a buffer block
+enum class KernelElement
+{
+    eAny,//blocks without a runtime array, arrays of structs, or blocks aliased with different types
+    eInt32,
+    eUint32,
+    eFloat32,
+    eFloat64
+};
+
+template<typename T>
+struct KernelElementOf
+{
+    static constexpr KernelElement value = KernelElement::eAny;
+};
+
+template<>
+struct KernelElementOf<int32_t>
+{
+    static constexpr KernelElement value = KernelElement::eInt32;
+};
+
+template<>
+struct KernelElementOf<uint32_t>
+{
+    static constexpr KernelElement value = KernelElement::eUint32;
+};
+
+template<>
+struct KernelElementOf<float>
+{
+    static constexpr KernelElement value = KernelElement::eFloat32;
+};
+
+template<>
+struct KernelElementOf<double>
+{
+    static constexpr KernelElement value = KernelElement::eFloat64;
+};
+
+inline const char* kernelElementName(KernelElement element)
+{
+    switch (element)
+    {
+    case KernelElement::eInt32:
+        return "int";
+    case KernelElement::eUint32:
+        return "uint";
+    case KernelElement::eFloat32:
+        return "float";
+    case KernelElement::eFloat64:
+        return "double";
+    default:
+        return "any";
+    }
+}
+
+//a buffer handed to a kernel with the type of the elements the caller stored in it,
+//checked against the shader's binding so a float buffer never lands in a double binding
+struct KernelArg
+{
+    vk::Buffer buffer;
+    KernelElement element = KernelElement::eAny;
+};
+
+//buffer of T, structs like SolverStatus come out as eAny and are not checked
+template<typename T>
+inline KernelArg kernelArg(vk::Buffer buffer)
+{
+    return KernelArg{ buffer, KernelElementOf<T>::value };
+}
+
+//descriptor bindings and push constant size of a compute shader, read from its SPIR-V
+struct KernelLayout
+{
+    std::vector<vk::DescriptorSetLayoutBinding> bindings;//sorted by binding
+    std::vector<KernelElement> elements;//one per binding
+    uint32_t pushConstantSize = 0;
+};
+
+//walks the SPIR-V instructions once, only buffers in set 0 and one push constant block are supported,
+//which is everything the shaders in this project use. fixed size arrays of blocks become one binding with descriptorCount > 1
+inline KernelLayout reflectKernelLayout(const std::vector<uint32_t>& code)
+{
+    enum Op : uint32_t
+    {
+        OpTypeBool = 20,
+        OpTypeInt = 21,
+        OpTypeFloat = 22,
+        OpTypeVector = 23,
+        OpTypeArray = 28,
+        OpTypeRuntimeArray = 29,
+        OpTypeStruct = 30,
+        OpTypePointer = 32,
+        OpConstant = 43,
+        OpVariable = 59,
+        OpDecorate = 71,
+        OpMemberDecorate = 72
+    };
+    enum Decoration : uint32_t
+    {
+        Block = 2,
+        BufferBlock = 3,
+        ArrayStride = 6,
+        Binding = 33,
+        DescriptorSet = 34,
+        Offset = 35
+    };
+    enum StorageClass : uint32_t
+    {
+        UniformConstant = 0,
+        Uniform = 2,
+        PushConstant = 9,
+        StorageBuffer = 12
+    };
+
+    if (code.size() < 5 || code[0] != 0x07230203)
+    {
+        throw std::runtime_error("not a SPIR-V module");
+    }
+
+    //every id keeps the instruction that defined it
+    std::unordered_map<uint32_t, std::vector<uint32_t>> types;
+    std::unordered_map<uint32_t, uint32_t> constants;
+    std::unordered_map<uint32_t, uint32_t> bindingOf;
+    std::unordered_map<uint32_t, uint32_t> setOf;
+    std::unordered_map<uint32_t, uint32_t> arrayStrides;
+    std::unordered_map<uint32_t, uint32_t> blockKinds;
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> memberOffsets;
+    std::vector<std::pair<uint32_t, uint32_t>> variables;//type, result id
+
+    for (size_t i = 5; i < code.size();)
+    {
+        uint32_t wordCount = code[i] >> 16;
+        uint32_t opcode = code[i] & 0xffff;
+        if (wordCount == 0 || i + wordCount > code.size())
+        {
+            throw std::runtime_error("truncated SPIR-V module");
+        }
+        const uint32_t* operands = &code[i + 1];
+        switch (opcode)
+        {
+        case OpTypeBool:
+        case OpTypeInt:
+        case OpTypeFloat:
+        case OpTypeVector:
+        case OpTypeArray:
+        case OpTypeRuntimeArray:
+        case OpTypeStruct:
+        case OpTypePointer:
+            types[operands[0]] = std::vector<uint32_t>(&code[i], &code[i] + wordCount);
+            break;
+        case OpConstant:
+            constants[operands[1]] = operands[2];
+            break;
+        case OpVariable:
+            variables.push_back({ operands[0], operands[1] });
+            break;
+        case OpDecorate:
+            if (operands[1] == Binding)
+            {
+                bindingOf[operands[0]] = operands[2];
+            }
+            else if (operands[1] == DescriptorSet)
+            {
+                setOf[operands[0]] = operands[2];
+            }
+            else if (operands[1] == ArrayStride)
+            {
+                arrayStrides[operands[0]] = operands[2];
+            }
+            else if (operands[1] == Block || operands[1] == BufferBlock)
+            {
+                blockKinds[operands[0]] = operands[1];
+            }
+            break;
+        case OpMemberDecorate:
+            if (operands[2] == Offset)
+            {
+                memberOffsets[{ operands[0], operands[1] }] = operands[3];
+            }
+            break;
+        default:
+            break;
+        }
+        i += wordCount;
+    }
+
+    auto typeOf = [&types](uint32_t id)->const std::vector<uint32_t>&
+    {
+        auto found = types.find(id);
+        if (found == types.end())
+        {
+            throw std::runtime_error("SPIR-V uses a type the reflection does not know");
+        }
+        return found->second;
+    };
+    //size of a type laid out with its explicit offsets and strides, runtime arrays count as empty
+    std::function<uint32_t(uint32_t)> sizeOf = [&](uint32_t id)->uint32_t
+    {
+        const std::vector<uint32_t>& type = typeOf(id);
+        switch (type[0] & 0xffff)
+        {
+        case OpTypeBool:
+            return 4;
+        case OpTypeInt:
+        case OpTypeFloat:
+            return type[2] / 8;
+        case OpTypeVector:
+            return sizeOf(type[2]) * type[3];
+        case OpTypeArray:
+        {
+            uint32_t stride = arrayStrides.count(id) ? arrayStrides[id] : sizeOf(type[2]);
+            return stride * constants[type[3]];
+        }
+        case OpTypeRuntimeArray:
+            return 0;
+        case OpTypeStruct:
+        {
+            uint32_t size = 0;
+            for (uint32_t member = 0; member + 2 < type.size(); member++)
+            {
+                auto offset = memberOffsets.find({ id, member });
+                uint32_t memberBegin = offset != memberOffsets.end() ? offset->second : size;
+                size = std::max(size, memberBegin + sizeOf(type[2 + member]));
+            }
+            return size;
+        }
+        default:
+            throw std::runtime_error("SPIR-V type is not allowed in a buffer or push constant block");
+        }
+    };
+
+    //what a block's trailing runtime array holds
+    auto elementOf = [&](uint32_t block)->KernelElement
+    {
+        const std::vector<uint32_t>& type = typeOf(block);
+        if ((type[0] & 0xffff) != OpTypeStruct || type.size() < 3)
+        {
+            return KernelElement::eAny;
+        }
+        const std::vector<uint32_t>& last = typeOf(type.back());
+        if ((last[0] & 0xffff) != OpTypeRuntimeArray)
+        {
+            return KernelElement::eAny;
+        }
+        std::vector<uint32_t> element = typeOf(last[2]);
+        if ((element[0] & 0xffff) == OpTypeVector)
+        {
+            element = typeOf(element[2]);
+        }
+        if ((element[0] & 0xffff) == OpTypeFloat)
+        {
+            return element[2] == 64 ? KernelElement::eFloat64 : element[2] == 32 ? KernelElement::eFloat32 : KernelElement::eAny;
+        }
+        if ((element[0] & 0xffff) == OpTypeInt && element[2] == 32)
+        {
+            return element[3] ? KernelElement::eInt32 : KernelElement::eUint32;
+        }
+        return KernelElement::eAny;
+    };
+
+    KernelLayout layout;
+    for (const auto& variable : variables)
+    {
+        const std::vector<uint32_t>& pointer = typeOf(variable.first);
+        uint32_t storageClass = pointer[2];
+        uint32_t pointee = pointer[3];
+        if (storageClass == PushConstant)
+        {
+            layout.pushConstantSize = sizeOf(pointee);
+            continue;
+        }
+        if (storageClass != Uniform && storageClass != StorageBuffer && storageClass != UniformConstant)
+        {
+            continue;
+        }
+        if (setOf.count(variable.second) && setOf[variable.second] != 0)
+        {
+            throw std::runtime_error("compute kernels only use descriptor set 0");
+        }
+
+        uint32_t descriptorCount = 1;
+        const std::vector<uint32_t>& pointeeType = typeOf(pointee);
+        if ((pointeeType[0] & 0xffff) == OpTypeArray)
+        {
+            descriptorCount = constants[pointeeType[3]];
+            pointee = pointeeType[2];
+        }
+        else if ((pointeeType[0] & 0xffff) == OpTypeRuntimeArray)
+        {
+            throw std::runtime_error("runtime sized descriptor arrays are not supported");
+        }
+        vk::DescriptorType descriptorType;
+        if (storageClass == StorageBuffer || (blockKinds.count(pointee) && blockKinds[pointee] == BufferBlock))
+        {
+            descriptorType = vk::DescriptorType::eStorageBuffer;
+        }
+        else if (storageClass == Uniform && blockKinds.count(pointee))
+        {
+            descriptorType = vk::DescriptorType::eUniformBuffer;
+        }
+        else
+        {
+            throw std::runtime_error("compute kernels only bind buffers");
+        }
+        //several blocks may alias one binding, like the dvec4 and double views of the elementwise kernels
+        //or the float and double views of the reductions, the latter take any element type
+        uint32_t binding = bindingOf[variable.second];
+        KernelElement element = elementOf(pointee);
+        auto aliased = std::find_if(layout.bindings.begin(), layout.bindings.end(),
+            [binding](const vk::DescriptorSetLayoutBinding& i) { return i.binding == binding; });
+        if (aliased != layout.bindings.end())
+        {
+            if (aliased->descriptorType != descriptorType || aliased->descriptorCount != descriptorCount)
+            {
+                throw std::runtime_error("aliased blocks of binding " + std::to_string(binding) + " disagree on the descriptor");
+            }
+            KernelElement& aliasedElement = layout.elements[aliased - layout.bindings.begin()];
+            if (aliasedElement != element)
+            {
+                aliasedElement = KernelElement::eAny;
+            }
+            continue;
+        }
+        layout.bindings.push_back({ binding, descriptorType, descriptorCount, vk::ShaderStageFlagBits::eCompute });
+        layout.elements.push_back(element);
+    }
+    std::vector<size_t> order(layout.bindings.size());
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&layout](size_t l, size_t r) { return layout.bindings[l].binding < layout.bindings[r].binding; });
+    KernelLayout sorted;
+    sorted.pushConstantSize = layout.pushConstantSize;
+    for (size_t i : order)
+    {
+        sorted.bindings.push_back(layout.bindings[i]);
+        sorted.elements.push_back(layout.elements[i]);
+    }
+    return sorted;
+}
+
+//one compute shader with its layouts reflected from the SPIR-V,
+//pipelines are built once per set of specialization constants and descriptor sets once per set of buffers,
+//a set stays cached until release is called with one of its buffers
+class ComputeKernel
+{
+public:
+    void init(SimpleComputeContext& context, const std::string& path)
+    {
+        this->context = &context;
+        device = context.getDevice();
+        code = SimpleComputeContext::readSpirvFile(path);
+        layout = reflectKernelLayout(code);
+        descriptorCount = 0;
+        for (const auto& i : layout.bindings)
+        {
+            descriptorCount += i.descriptorCount;
+        }
+
+        vk::DescriptorSetLayoutCreateInfo setLayoutInfo({}, static_cast<uint32_t>(layout.bindings.size()), layout.bindings.data());
+        setLayout = device.createDescriptorSetLayout(setLayoutInfo);
+        vk::PushConstantRange pushRange(vk::ShaderStageFlagBits::eCompute, 0, layout.pushConstantSize);
+        vk::PipelineLayoutCreateInfo pipelineLayoutInfo({}, 1, &setLayout, layout.pushConstantSize > 0 ? 1 : 0, &pushRange);
+        pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
+    }
+
+    inline const KernelLayout& getLayout()const { return layout; }
+    inline vk::PipelineLayout getPipelineLayout()const { return pipelineLayout; }
+
+    //workgroup size goes to constant id 0 and extraConstants to ids 1, 2, ... like loadComputePipeline
+    vk::Pipeline pipeline(uint32_t workGroupSize, const std::vector<uint32_t>& extraConstants = {})
+    {
+        std::vector<uint32_t> key{ workGroupSize };
+        key.insert(key.end(), extraConstants.begin(), extraConstants.end());
+        auto found = pipelines.find(key);
+        if (found != pipelines.end())
+        {
+            return found->second;
+        }
+        vk::Pipeline created = context->createComputePipeline(code, pipelineLayout, workGroupSize, extraConstants);
+        pipelines[key] = created;
+        return created;
+    }
+
+    //args fill the bindings in binding order, an array binding of count descriptors takes the next count args,
+    //every descriptor takes the whole buffer
+    vk::DescriptorSet descriptorSet(const std::vector<KernelArg>& args)
+    {
+        if (args.size() != descriptorCount)
+        {
+            throw std::runtime_error("kernel expects " + std::to_string(descriptorCount) + " buffers, got " + std::to_string(args.size()));
+        }
+        std::vector<vk::Buffer> buffers;
+        size_t arg = 0;
+        for (size_t k = 0; k < layout.bindings.size(); k++)
+        {
+            for (uint32_t i = 0; i < layout.bindings[k].descriptorCount; i++, arg++)
+            {
+                KernelElement expected = layout.elements[k];
+                if (expected != KernelElement::eAny && args[arg].element != KernelElement::eAny && args[arg].element != expected)
+                {
+                    throw std::runtime_error("binding " + std::to_string(layout.bindings[k].binding) + " holds " + kernelElementName(expected) +
+                        ", got a buffer of " + kernelElementName(args[arg].element));
+                }
+                buffers.push_back(args[arg].buffer);
+            }
+        }
+        auto found = descriptorSets.find(buffers);
+        if (found != descriptorSets.end())
+        {
+            return found->second;
+        }
+
+        vk::DescriptorSet set;
+        if (!freeSets.empty())
+        {
+            set = freeSets.back();
+            freeSets.pop_back();
+        }
+        else
+        {
+            if (descriptorPools.empty() || setsInLastPool == setsPerPool)
+            {
+                addDescriptorPool();
+            }
+            vk::DescriptorSetAllocateInfo setAllocateInfo(descriptorPools.back(), 1, &setLayout);
+            set = device.allocateDescriptorSets(setAllocateInfo).front();
+            setsInLastPool++;
+        }
+
+        std::vector<vk::DescriptorBufferInfo> bufferInfos;
+        for (auto i : buffers)
+        {
+            bufferInfos.push_back({ i,0,VK_WHOLE_SIZE });
+        }
+        std::vector<vk::WriteDescriptorSet> writes;
+        size_t first = 0;
+        for (const auto& i : layout.bindings)
+        {
+            writes.push_back({ set,i.binding,0,i.descriptorCount,i.descriptorType,nullptr,&bufferInfos[first] });
+            first += i.descriptorCount;
+        }
+        device.updateDescriptorSets(writes, {});
+        descriptorSets[buffers] = set;
+        return set;
+    }
+
+    //drops the cached sets that bind buffer, call it before destroying a buffer this kernel was recorded with
+    //so a later buffer with the same handle never gets the stale set, dropped sets are rewritten for new buffers
+    void release(vk::Buffer buffer)
+    {
+        for (auto i = descriptorSets.begin(); i != descriptorSets.end();)
+        {
+            if (std::find(i->first.begin(), i->first.end(), buffer) != i->first.end())
+            {
+                freeSets.push_back(i->second);
+                i = descriptorSets.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    //binds pipeline, buffers and push constants, then dispatches groupCountX x groupCountY x groupCountZ workgroups
+    template<typename PushConstants>
+    void record(vk::CommandBuffer command, vk::Pipeline kernelPipeline, const std::vector<KernelArg>& args, const PushConstants& pushConst,
+        uint32_t groupCountX, uint32_t groupCountY = 1, uint32_t groupCountZ = 1)
+    {
+        bindAll(command, kernelPipeline, args, &pushConst, sizeof(PushConstants));
+        command.dispatch(groupCountX, groupCountY, groupCountZ);
+    }
+
+    //same as record, the workgroup count is read from indirectBuffer at offset
+    template<typename PushConstants>
+    void recordIndirect(vk::CommandBuffer command, vk::Pipeline kernelPipeline, const std::vector<KernelArg>& args, const PushConstants& pushConst,
+        vk::Buffer indirectBuffer, vk::DeviceSize offset = 0)
+    {
+        bindAll(command, kernelPipeline, args, &pushConst, sizeof(PushConstants));
+        command.dispatchIndirect(indirectBuffer, offset);
+    }
+
+    void destroy()
+    {
+        for (const auto& i : pipelines)
+        {
+            device.destroyPipeline(i.second);
+        }
+        for (auto i : descriptorPools)
+        {
+            device.destroyDescriptorPool(i);
+        }
+        pipelines.clear();
+        descriptorPools.clear();
+        descriptorSets.clear();
+        freeSets.clear();
+        device.destroyPipelineLayout(pipelineLayout);
+        device.destroyDescriptorSetLayout(setLayout);
+    }
+private:
+    static constexpr uint32_t setsPerPool = 16;
+
+    SimpleComputeContext* context = nullptr;
+    vk::Device device;
+    std::vector<uint32_t> code;
+    KernelLayout layout;
+    //descriptors of all bindings, the number of args a dispatch takes
+    size_t descriptorCount = 0;
+
+    vk::DescriptorSetLayout setLayout;
+    vk::PipelineLayout pipelineLayout;
+    std::map<std::vector<uint32_t>, vk::Pipeline> pipelines;
+
+    std::vector<vk::DescriptorPool> descriptorPools;
+    uint32_t setsInLastPool = 0;
+    std::map<std::vector<vk::Buffer>, vk::DescriptorSet> descriptorSets;
+    //released sets of this layout waiting to be rewritten
+    std::vector<vk::DescriptorSet> freeSets;
+
+    void addDescriptorPool()
+    {
+        std::vector<vk::DescriptorPoolSize> poolSizes;
+        for (const auto& i : layout.bindings)
+        {
+            poolSizes.push_back({ i.descriptorType, i.descriptorCount * setsPerPool });
+        }
+        vk::DescriptorPoolCreateInfo poolInfo({}, setsPerPool, static_cast<uint32_t>(poolSizes.size()), poolSizes.data());
+        descriptorPools.push_back(device.createDescriptorPool(poolInfo));
+        setsInLastPool = 0;
+    }
+
+    void bindAll(vk::CommandBuffer command, vk::Pipeline kernelPipeline, const std::vector<KernelArg>& args, const void* pushConst, size_t pushConstSize)
+    {
+        if (pushConstSize < layout.pushConstantSize)
+        {
+            throw std::runtime_error("push constants are smaller than the shader's push constant block");
+        }
+        command.bindPipeline(vk::PipelineBindPoint::eCompute, kernelPipeline);
+        command.bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, descriptorSet(args), {});
+        if (layout.pushConstantSize > 0)
+        {
+            command.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, layout.pushConstantSize, pushConst);
+        }
+    }
+};
@@ -0,0 +1,93 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<array>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+
+//matches SolverStatus in jacobiConvergence.comp, starts with the indirect dispatch of the iteration kernel
+struct SolverStatus
+{
+    vk::DispatchIndirectCommand iterationDispatch;
+    uint32_t converged;
+    double updateNorm;
+    uint32_t checkCount;
+};
+
+//compares the two ping-pong iterates on the GPU and empties the iteration dispatch once they agree
+class ConvergenceCheck
+{
+public:
+    struct PushConstants
+    {
+        int32_t nElem;
+        int32_t padding;
+        double tolerance;
+    };
+
+    void init(SimpleComputeContext& context, vk::Buffer newX, vk::Buffer oldX, uint32_t nElem, uint32_t workGroupSize,
+        vk::DispatchIndirectCommand iterationDispatch, double tolerance)
+    {
+        this->context = &context;
+        device = context.getDevice();
+        pushConst = PushConstants{ static_cast<int32_t>(nElem), 0, tolerance };
+
+        SolverStatus initialStatus{ iterationDispatch, 0, 0.0, 0 };
+        std::tie(statusBuffer, statusBufferMemory) = context.createHostBuffer(sizeof(SolverStatus), vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+        void* statusPtr = device.mapMemory(statusBufferMemory, 0, sizeof(SolverStatus));
+        memcpy(statusPtr, &initialStatus, sizeof(SolverStatus));
+        device.unmapMemory(statusBufferMemory);
+
+        kernel.init(context, "./shaders/jacobiConvergence.spv");
+        pipeline = kernel.pipeline(workGroupSize);
+        args = { kernelArg<double>(newX), kernelArg<double>(oldX), kernelArg<SolverStatus>(statusBuffer) };
+    }
+
+    //iteration kernels are dispatched with dispatchIndirect(getStatusBuffer(), 0)
+    inline vk::Buffer getStatusBuffer()const { return statusBuffer; }
+
+    //binds its own pipeline, the caller has to rebind the iteration pipeline and push constants afterwards
+    void record(vk::CommandBuffer commandBuffer)
+    {
+        kernel.record(commandBuffer, pipeline, args, pushConst, 1);
+        //also orders the first dispatch of the next submitted batch
+        vk::MemoryBarrier checkToIteration(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eIndirectCommandRead);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader | vk::PipelineStageFlagBits::eDrawIndirect, {}, checkToIteration, {}, {});
+    }
+
+    //submits the batch until the flag is set or batchCount batches ran, timed batches log the update norm as residual
+    SolverStatus runBatches(vk::CommandBuffer batchCommandBuffer, int batchCount)
+    {
+        const SolverStatus* status = static_cast<const SolverStatus*>(device.mapMemory(statusBufferMemory, 0, sizeof(SolverStatus)));
+        context->submitBatchesUntil(batchCommandBuffer, batchCount, &status->converged, &status->updateNorm);
+        SolverStatus result = *status;
+        device.unmapMemory(statusBufferMemory);
+        return result;
+    }
+
+    //status after the last check, the caller has to wait for the submission that recorded it
+    SolverStatus readStatus()const
+    {
+        SolverStatus result;
+        void* statusPtr = device.mapMemory(statusBufferMemory, 0, sizeof(SolverStatus));
+        memcpy(&result, statusPtr, sizeof(SolverStatus));
+        device.unmapMemory(statusBufferMemory);
+        return result;
+    }
+
+    void destroy()
+    {
+        context->destroyBufferAndFreeMemory(statusBuffer, statusBufferMemory);
+        kernel.destroy();
+    }
+private:
+    SimpleComputeContext* context = nullptr;
+    vk::Device device;
+    PushConstants pushConst{};
+
+    vk::Buffer statusBuffer;
+    vk::DeviceMemory statusBufferMemory;
+
+    ComputeKernel kernel;
+    vk::Pipeline pipeline;
+    std::vector<KernelArg> args;
+};
@@ -0,0 +1,569 @@
+#pragma once
+#include<armadillo>
+#include<memory>
+#include<vector>
+#include<algorithm>
+#include<cmath>
+#include<tuple>
+#include<fmt/format.h>
+#include"LinearSolver.h"
+#include"ThreadPool.h"
+#include"CsrMatrix.h"
+
+//the SIMD kernels are compiled for AVX2 and AVX-512 next to the scalar ones and picked at runtime from cpuid,
+//so the binary needs no /arch flag and still runs on machines without AVX2
+#if defined(_M_X64) || defined(__x86_64__)
+#define CPU_SOLVER_X86 1
+#include<immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include<intrin.h>
+//MSVC emits any intrinsic regardless of /arch
+#define CPU_TARGET_AVX2
+#define CPU_TARGET_AVX512
+#else
+#define CPU_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define CPU_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#endif
+#else
+#define CPU_SOLVER_X86 0
+#endif
+
+enum class CpuIsa
+{
+    eScalar,
+    eAvx2,//with FMA
+    eAvx512
+};
+
+//widest instruction set the CPU and the operating system both support
+inline CpuIsa detectCpuIsa()
+{
+#if CPU_SOLVER_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int maxLeaf = info[0];
+    __cpuid(info, 1);
+    bool fma = (info[2] & (1 << 12)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!fma || !osxsave || !avx || maxLeaf < 7)
+    {
+        return CpuIsa::eScalar;
+    }
+    //the operating system has to save the ymm and zmm registers
+    unsigned long long xcr0 = _xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6)
+    {
+        return CpuIsa::eScalar;
+    }
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    bool avx512 = (info[1] & (1 << 16)) != 0 && (xcr0 & 0xe6) == 0xe6;
+    return avx512 ? CpuIsa::eAvx512 : avx2 ? CpuIsa::eAvx2 : CpuIsa::eScalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return CpuIsa::eAvx512;
+    }
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? CpuIsa::eAvx2 : CpuIsa::eScalar;
+#endif
+#else
+    return CpuIsa::eScalar;
+#endif
+}
+
+inline const char* cpuIsaName(CpuIsa isa)
+{
+    switch (isa)
+    {
+    case CpuIsa::eAvx512:
+        return "avx-512";
+    case CpuIsa::eAvx2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+//sum of values[k] * x[colIdx[k]] over [begin, end)
+inline double sparseRowDotScalar(const double* values, const uint32_t* colIdx, uint32_t begin, uint32_t end, const double* x)
+{
+    double sum = 0.0;
+    for (uint32_t k = begin; k < end; k++)
+    {
+        sum += values[k] * x[colIdx[k]];
+    }
+    return sum;
+}
+
+//sum of a[i] * b[i] over [begin, end)
+inline double denseDotScalar(const double* a, const double* b, uint32_t begin, uint32_t end)
+{
+    double sum = 0.0;
+    for (uint32_t i = begin; i < end; i++)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+//y = alpha * x + beta * y over [begin, end)
+inline void denseAxpbyScalar(double alpha, const double* x, double beta, double* y, uint32_t begin, uint32_t end)
+{
+    for (uint32_t i = begin; i < end; i++)
+    {
+        y[i] = alpha * x[i] + beta * y[i];
+    }
+}
+
+#if CPU_SOLVER_X86
+CPU_TARGET_AVX2 inline double horizontalSum(__m256d acc)
+{
+    __m128d half = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+}
+
+//gathers x four at a time
+CPU_TARGET_AVX2 inline double sparseRowDotAvx2(const double* values, const uint32_t* colIdx, uint32_t begin, uint32_t end, const double* x)
+{
+    __m256d acc = _mm256_setzero_pd();
+    uint32_t k = begin;
+    for (; k + 4 <= end; k += 4)
+    {
+        __m128i idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colIdx + k));
+        acc = _mm256_fmadd_pd(_mm256_loadu_pd(values + k), _mm256_i32gather_pd(x, idx, sizeof(double)), acc);
+    }
+    return horizontalSum(acc) + sparseRowDotScalar(values, colIdx, k, end, x);
+}
+
+CPU_TARGET_AVX2 inline double denseDotAvx2(const double* a, const double* b, uint32_t begin, uint32_t end)
+{
+    __m256d acc = _mm256_setzero_pd();
+    uint32_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        acc = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc);
+    }
+    return horizontalSum(acc) + denseDotScalar(a, b, i, end);
+}
+
+CPU_TARGET_AVX2 inline void denseAxpbyAvx2(double alpha, const double* x, double beta, double* y, uint32_t begin, uint32_t end)
+{
+    __m256d alphaVec = _mm256_set1_pd(alpha);
+    __m256d betaVec = _mm256_set1_pd(beta);
+    uint32_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        _mm256_storeu_pd(y + i, _mm256_fmadd_pd(alphaVec, _mm256_loadu_pd(x + i), _mm256_mul_pd(betaVec, _mm256_loadu_pd(y + i))));
+    }
+    denseAxpbyScalar(alpha, x, beta, y, i, end);
+}
+
+CPU_TARGET_AVX512 inline double sparseRowDotAvx512(const double* values, const uint32_t* colIdx, uint32_t begin, uint32_t end, const double* x)
+{
+    __m512d acc = _mm512_setzero_pd();
+    uint32_t k = begin;
+    for (; k + 8 <= end; k += 8)
+    {
+        __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(colIdx + k));
+        acc = _mm512_fmadd_pd(_mm512_loadu_pd(values + k), _mm512_i32gather_pd(idx, x, sizeof(double)), acc);
+    }
+    return _mm512_reduce_add_pd(acc) + sparseRowDotScalar(values, colIdx, k, end, x);
+}
+
+CPU_TARGET_AVX512 inline double denseDotAvx512(const double* a, const double* b, uint32_t begin, uint32_t end)
+{
+    __m512d acc = _mm512_setzero_pd();
+    uint32_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        acc = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc);
+    }
+    return _mm512_reduce_add_pd(acc) + denseDotScalar(a, b, i, end);
+}
+
+CPU_TARGET_AVX512 inline void denseAxpbyAvx512(double alpha, const double* x, double beta, double* y, uint32_t begin, uint32_t end)
+{
+    __m512d alphaVec = _mm512_set1_pd(alpha);
+    __m512d betaVec = _mm512_set1_pd(beta);
+    uint32_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        _mm512_storeu_pd(y + i, _mm512_fmadd_pd(alphaVec, _mm512_loadu_pd(x + i), _mm512_mul_pd(betaVec, _mm512_loadu_pd(y + i))));
+    }
+    denseAxpbyScalar(alpha, x, beta, y, i, end);
+}
+#endif
+
+//the kernel set of one instruction set, chosen once per solver
+struct CpuKernels
+{
+    CpuIsa isa = CpuIsa::eScalar;
+    double(*sparseRowDot)(const double*, const uint32_t*, uint32_t, uint32_t, const double*) = sparseRowDotScalar;
+    double(*denseDot)(const double*, const double*, uint32_t, uint32_t) = denseDotScalar;
+    void(*denseAxpby)(double, const double*, double, double*, uint32_t, uint32_t) = denseAxpbyScalar;
+
+    static CpuKernels select(CpuIsa isa = detectCpuIsa())
+    {
+        CpuKernels kernels;
+        kernels.isa = isa;
+#if CPU_SOLVER_X86
+        if (isa == CpuIsa::eAvx512)
+        {
+            kernels.sparseRowDot = sparseRowDotAvx512;
+            kernels.denseDot = denseDotAvx512;
+            kernels.denseAxpby = denseAxpbyAvx512;
+        }
+        else if (isa == CpuIsa::eAvx2)
+        {
+            kernels.sparseRowDot = sparseRowDotAvx2;
+            kernels.denseDot = denseDotAvx2;
+            kernels.denseAxpby = denseAxpbyAvx2;
+        }
+#endif
+        return kernels;
+    }
+};
+
+//Jacobi, hybrid Gauss-Seidel and CG on all cores, a baseline for the Vulkan solvers behind the same interface.
+//sparse systems are kept in CSR, dense ones as row major rows
+class CpuSolver :public LinearSolver
+{
+public:
+    enum class Method
+    {
+        eJacobi,
+        eGaussSeidel,
+        eConjugateGradient
+    };
+private:
+    //arrays are left uninitialized on allocation, the worker owning a range writes it first
+    //so the operating system places those pages on the worker's memory node
+    using Array = std::unique_ptr<double[]>;
+
+    ThreadPool pool;
+    CpuKernels kernels;
+    Method method = Method::eJacobi;
+    uint32_t n = 0;
+    //values holds the n x n rows and rowPtr[i] = i * n, colIdx is unused
+    bool dense = false;
+    std::vector<uint32_t> rowPtr;
+    std::unique_ptr<uint32_t[]> colIdx;
+    Array values;
+    Array diagonal;
+    Array vectorB;
+    Array x;
+    //Jacobi and Gauss-Seidel write the next iterate here, CG keeps r, p and Ap
+    Array nextX;
+    Array r;
+    Array p;
+    Array ap;
+
+    //worker t owns rows [rowBegin[t], rowBegin[t + 1]), split so every worker gets about the same nonzeros
+    std::vector<uint32_t> rowBegin;
+    std::vector<double> workerPartials;
+
+    int maxIterations = 0;
+    double tolerance = 1e-10;
+
+    void partitionRows()
+    {
+        unsigned workers = pool.size();
+        rowBegin.assign(workers + 1, n);
+        uint32_t nonZeros = rowPtr.back();
+        for (unsigned t = 0; t < workers; t++)
+        {
+            uint32_t target = static_cast<uint32_t>(static_cast<uint64_t>(nonZeros) * t / workers);
+            rowBegin[t] = static_cast<uint32_t>(std::lower_bound(rowPtr.begin(), rowPtr.end() - 1, target) - rowPtr.begin());
+        }
+        workerPartials.assign(workers, 0.0);
+    }
+
+    //row of A times v
+    double rowDot(uint32_t row, const double* v)const
+    {
+        if (dense)
+        {
+            return kernels.denseDot(values.get() + rowPtr[row], v, 0, n);
+        }
+        return kernels.sparseRowDot(values.get(), colIdx.get(), rowPtr[row], rowPtr[row + 1], v);
+    }
+
+    void allocateVectors()
+    {
+        for (auto i : { &diagonal, &vectorB, &x, &nextX, &r, &p, &ap })
+        {
+            i->reset(new double[n]);
+        }
+    }
+
+    //x starts at 0, so r and p start at b
+    void initVectors(unsigned t, const arma::vec& b)
+    {
+        for (uint32_t row = rowBegin[t]; row < rowBegin[t + 1]; row++)
+        {
+            vectorB[row] = b[row];
+            x[row] = 0.0;
+            nextX[row] = 0.0;
+            r[row] = b[row];
+            p[row] = b[row];
+            ap[row] = 0.0;
+        }
+    }
+
+    double maxOfPartials()const
+    {
+        return *std::max_element(workerPartials.begin(), workerPartials.end());
+    }
+
+    double sumOfPartials()const
+    {
+        double sum = 0.0;
+        for (auto i : workerPartials)
+        {
+            sum += i;
+        }
+        return sum;
+    }
+
+    //one Jacobi or Gauss-Seidel sweep, returns the largest update
+    double relaxationSweep()
+    {
+        pool.run([this](unsigned t)
+            {
+                double localMax = 0.0;
+                for (uint32_t row = rowBegin[t]; row < rowBegin[t + 1]; row++)
+                {
+                    double offDiagonal = 0.0;
+                    if (method == Method::eJacobi)
+                    {
+                        offDiagonal = rowDot(row, x.get()) - diagonal[row] * x[row];
+                    }
+                    else if (dense)
+                    {
+                        const double* rowA = values.get() + rowPtr[row];
+                        offDiagonal = kernels.denseDot(rowA, x.get(), 0, rowBegin[t]) + kernels.denseDot(rowA, nextX.get(), rowBegin[t], row) +
+                            kernels.denseDot(rowA, x.get(), row + 1, n);
+                    }
+                    else
+                    {
+                        //rows of this worker that are already updated come from nextX, everything else from x
+                        for (uint32_t k = rowPtr[row]; k < rowPtr[row + 1]; k++)
+                        {
+                            uint32_t col = colIdx[k];
+                            if (col >= rowBegin[t] && col < row)
+                            {
+                                offDiagonal += values[k] * nextX[col];
+                            }
+                            else if (col != row)
+                            {
+                                offDiagonal += values[k] * x[col];
+                            }
+                        }
+                    }
+                    nextX[row] = (vectorB[row] - offDiagonal) / diagonal[row];
+                    localMax = std::max(localMax, std::abs(nextX[row] - x[row]));
+                }
+                workerPartials[t] = localMax;
+            });
+        std::swap(x, nextX);
+        return maxOfPartials();
+    }
+
+    //returns the number of iterations and whether the update fell below the tolerance
+    std::tuple<int, bool> runRelaxation(int iterationLimit)
+    {
+        for (int i = 0; i < iterationLimit; i++)
+        {
+            if (relaxationSweep() <= tolerance)
+            {
+                return { i + 1, true };
+            }
+        }
+        return { iterationLimit, false };
+    }
+
+    std::tuple<int, bool> runConjugateGradient(int iterationLimit)
+    {
+        pool.run([this](unsigned t)
+            {
+                workerPartials[t] = kernels.denseDot(r.get(), r.get(), rowBegin[t], rowBegin[t + 1]);
+            });
+        double rr = sumOfPartials();
+        double toleranceSquared = tolerance * tolerance * rr;
+        for (int i = 0; i < iterationLimit; i++)
+        {
+            if (rr <= toleranceSquared)
+            {
+                return { i, true };
+            }
+            pool.run([this](unsigned t)
+                {
+                    for (uint32_t row = rowBegin[t]; row < rowBegin[t + 1]; row++)
+                    {
+                        ap[row] = rowDot(row, p.get());
+                    }
+                    workerPartials[t] = kernels.denseDot(p.get(), ap.get(), rowBegin[t], rowBegin[t + 1]);
+                });
+            double alpha = rr / sumOfPartials();
+            pool.run([this, alpha](unsigned t)
+                {
+                    kernels.denseAxpby(alpha, p.get(), 1.0, x.get(), rowBegin[t], rowBegin[t + 1]);
+                    kernels.denseAxpby(-alpha, ap.get(), 1.0, r.get(), rowBegin[t], rowBegin[t + 1]);
+                    workerPartials[t] = kernels.denseDot(r.get(), r.get(), rowBegin[t], rowBegin[t + 1]);
+                });
+            double rrNew = sumOfPartials();
+            double beta = rrNew / rr;
+            rr = rrNew;
+            pool.run([this, beta](unsigned t)
+                {
+                    kernels.denseAxpby(1.0, r.get(), beta, p.get(), rowBegin[t], rowBegin[t + 1]);
+                });
+        }
+        return { iterationLimit, rr <= toleranceSquared };
+    }
+public:
+    explicit CpuSolver(Method solveMethod = Method::eJacobi, unsigned threadCount = std::thread::hardware_concurrency())
+        :pool(threadCount), kernels(CpuKernels::select()), method(solveMethod)
+    {
+    }
+
+    inline CpuIsa getIsa()const { return kernels.isa; }
+
+    //Jacobi and Gauss-Seidel stop on the largest update, CG once norm(b - A * x) <= tolerance * norm(b)
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    //upper bound on the number of iterations, 0 uses 5 * n for the relaxations and n for CG
+    void setMaxIterations(int iterations)
+    {
+        maxIterations = iterations;
+    }
+
+    void init(const arma::sp_mat& matA, const arma::vec& b) override
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != b.n_elem)
+        {
+            throw std::runtime_error("cpu solver needs a square matrix matching b");
+        }
+        CsrMatrix csr = CsrMatrix::fromArma(matA);
+        if (method != Method::eConjugateGradient)
+        {
+            csr.requireNonzeroDiagonal();
+        }
+        dense = false;
+        n = csr.n_rows;
+        rowPtr = std::move(csr.rowPtr);
+        partitionRows();
+
+        colIdx.reset(new uint32_t[csr.nonZeros()]);
+        values.reset(new double[csr.nonZeros()]);
+        allocateVectors();
+
+        //first touch by the owning worker
+        pool.run([this, &csr, &b](unsigned t)
+            {
+                uint32_t nonZeroBegin = rowPtr[rowBegin[t]];
+                uint32_t nonZeroEnd = rowPtr[rowBegin[t + 1]];
+                std::copy(csr.colIdx.begin() + nonZeroBegin, csr.colIdx.begin() + nonZeroEnd, colIdx.get() + nonZeroBegin);
+                std::copy(csr.values.begin() + nonZeroBegin, csr.values.begin() + nonZeroEnd, values.get() + nonZeroBegin);
+                for (uint32_t row = rowBegin[t]; row < rowBegin[t + 1]; row++)
+                {
+                    //only cg runs without a diagonal, and it never reads it
+                    diagonal[row] = 0.0;
+                    for (uint32_t k = rowPtr[row]; k < rowPtr[row + 1]; k++)
+                    {
+                        if (colIdx[k] == row)
+                        {
+                            diagonal[row] = values[k];
+                        }
+                    }
+                }
+                initVectors(t, b);
+            });
+    }
+
+    //dense A is stored as row major rows, the SIMD dot products then stream each row
+    void init(const arma::mat& matA, const arma::vec& b) override
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != b.n_elem)
+        {
+            throw std::runtime_error("cpu solver needs a square matrix matching b");
+        }
+        if (matA.n_elem > UINT32_MAX)
+        {
+            throw std::runtime_error("dense cpu solver addresses A with 32 bit offsets");
+        }
+        if (method != Method::eConjugateGradient)
+        {
+            for (arma::uword row = 0; row < matA.n_rows; row++)
+            {
+                if (matA(row, row) == 0.0)
+                {
+                    throw std::runtime_error("row " + std::to_string(row) + " has a zero diagonal entry");
+                }
+            }
+        }
+        dense = true;
+        n = static_cast<uint32_t>(matA.n_rows);
+        rowPtr.resize(n + 1);
+        for (uint32_t i = 0; i <= n; i++)
+        {
+            rowPtr[i] = i * n;
+        }
+        partitionRows();
+
+        colIdx.reset();
+        values.reset(new double[matA.n_elem]);
+        allocateVectors();
+
+        pool.run([this, &matA, &b](unsigned t)
+            {
+                for (uint32_t row = rowBegin[t]; row < rowBegin[t + 1]; row++)
+                {
+                    double* rowA = values.get() + rowPtr[row];
+                    for (uint32_t col = 0; col < n; col++)
+                    {
+                        rowA[col] = matA(row, col);
+                    }
+                    diagonal[row] = matA(row, row);
+                }
+                initVectors(t, b);
+            });
+    }
+
+    arma::vec run() override
+    {
+        int iterations = 0;
+        bool converged = false;
+        const char* methodName = "jacobi";
+        if (method == Method::eConjugateGradient)
+        {
+            methodName = "cg";
+            std::tie(iterations, converged) = runConjugateGradient(maxIterations > 0 ? maxIterations : static_cast<int>(n));
+        }
+        else
+        {
+            methodName = method == Method::eJacobi ? "jacobi" : "gauss-seidel";
+            std::tie(iterations, converged) = runRelaxation(maxIterations > 0 ? maxIterations : 5 * static_cast<int>(n));
+        }
+        report.iterations = iterations;
+        report.converged = converged;
+        fmt::print("cpu {} {} after {} iterations on {} threads with {} kernels\n", methodName, converged ? "converged" : "did not converge",
+            iterations, pool.size(), cpuIsaName(kernels.isa));
+        return arma::vec(x.get(), n);
+    }
+
+    void destroy() override
+    {
+        colIdx.reset();
+        for (auto i : { &values, &diagonal, &vectorB, &x, &nextX, &r, &p, &ap })
+        {
+            i->reset();
+        }
+    }
+};
@@ -0,0 +1,136 @@
+#pragma once
+#include<armadillo>
+#include<vector>
+#include<limits>
+#include<stdexcept>
+#include<string>
+
+//compressed sparse row storage with 32 bit indices, the layout the sparse kernels read
+struct CsrMatrix
+{
+    uint32_t n_rows = 0;
+    uint32_t n_cols = 0;
+    std::vector<uint32_t> rowPtr;
+    std::vector<uint32_t> colIdx;
+    std::vector<double> values;
+
+    inline uint32_t nonZeros()const { return static_cast<uint32_t>(values.size()); }
+
+    //armadillo keeps sparse matrices column compressed, the columns of the transpose are our rows
+    static CsrMatrix fromArma(const arma::sp_mat& mat)
+    {
+        if (mat.n_nonzero > std::numeric_limits<uint32_t>::max() || mat.n_cols > std::numeric_limits<uint32_t>::max())
+        {
+            throw std::runtime_error("sparse matrix too large for 32 bit indices");
+        }
+
+        arma::sp_mat transposed = mat.t();
+        transposed.sync();
+        CsrMatrix result;
+        result.n_rows = static_cast<uint32_t>(mat.n_rows);
+        result.n_cols = static_cast<uint32_t>(mat.n_cols);
+        result.rowPtr.resize(transposed.n_cols + 1);
+        result.colIdx.resize(transposed.n_nonzero);
+        for (arma::uword i = 0; i <= transposed.n_cols; i++)
+        {
+            result.rowPtr[i] = static_cast<uint32_t>(transposed.col_ptrs[i]);
+        }
+        for (arma::uword i = 0; i < transposed.n_nonzero; i++)
+        {
+            result.colIdx[i] = static_cast<uint32_t>(transposed.row_indices[i]);
+        }
+        result.values.assign(transposed.values, transposed.values + transposed.n_nonzero);
+        return result;
+    }
+
+    //our rows are the columns of the transpose, armadillo builds that one and transposes it back
+    arma::sp_mat toArma()const
+    {
+        arma::uvec rowIndices(colIdx.size());
+        arma::uvec colPtrs(rowPtr.size());
+        for (size_t i = 0; i < colIdx.size(); i++)
+        {
+            rowIndices[i] = colIdx[i];
+        }
+        for (size_t i = 0; i < rowPtr.size(); i++)
+        {
+            colPtrs[i] = rowPtr[i];
+        }
+        arma::sp_mat transposed(rowIndices, colPtrs, arma::vec(values), n_cols, n_rows);
+        return transposed.t();
+    }
+
+    //Jacobi and Gauss-Seidel style sweeps divide by the diagonal, throws naming the first row where it is missing or zero
+    void requireNonzeroDiagonal()const
+    {
+        for (uint32_t row = 0; row < n_rows; row++)
+        {
+            bool found = false;
+            for (uint32_t k = rowPtr[row]; k < rowPtr[row + 1]; k++)
+            {
+                if (colIdx[k] != row)
+                {
+                    continue;
+                }
+                if (values[k] == 0.0)
+                {
+                    throw std::runtime_error("row " + std::to_string(row) + " has a zero diagonal entry");
+                }
+                found = true;
+            }
+            if (!found)
+            {
+                throw std::runtime_error("row " + std::to_string(row) + " has no diagonal entry");
+            }
+        }
+    }
+
+    //A * x without converting to armadillo
+    arma::vec multiply(const arma::vec& x)const
+    {
+        arma::vec result(n_rows);
+        for (uint32_t row = 0; row < n_rows; row++)
+        {
+            double sum = 0.0;
+            for (uint32_t k = rowPtr[row]; k < rowPtr[row + 1]; k++)
+            {
+                sum += values[k] * x[colIdx[k]];
+            }
+            result[row] = sum;
+        }
+        return result;
+    }
+};
+
+//greedy coloring of the symmetrized sparsity pattern, two rows of one color never reference each other
+//so every color can be relaxed in place by one parallel dispatch
+inline std::vector<uint32_t> greedyColoring(const arma::sp_mat& mat)
+{
+    CsrMatrix pattern = CsrMatrix::fromArma(arma::spones(mat) + arma::spones(mat.t()));
+    const uint32_t uncolored = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> colors(pattern.n_rows, uncolored);
+    //colorTakenBy[c] == row marks color c as used by a neighbour of row
+    std::vector<uint32_t> colorTakenBy;
+    for (uint32_t row = 0; row < pattern.n_rows; row++)
+    {
+        for (uint32_t k = pattern.rowPtr[row]; k < pattern.rowPtr[row + 1]; k++)
+        {
+            uint32_t col = pattern.colIdx[k];
+            if (col != row && colors[col] != uncolored)
+            {
+                colorTakenBy[colors[col]] = row;
+            }
+        }
+        uint32_t color = 0;
+        while (color < colorTakenBy.size() && colorTakenBy[color] == row)
+        {
+            color++;
+        }
+        if (color == colorTakenBy.size())
+        {
+            colorTakenBy.push_back(uncolored);
+        }
+        colors[row] = color;
+    }
+    return colors;
+}
@@ -0,0 +1,245 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<algorithm>
+#include<array>
+#include<functional>
+#include<type_traits>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+
+//tiled GEMV and GEMM on column major float or double buffers, the same storage armadillo uses,
+//so an arma::mat or arma::fmat can be uploaded from memptr() as is
+class DenseKernels
+{
+public:
+    enum class ElementType
+    {
+        eDouble,
+        eFloat
+    };
+
+    template<typename T>
+    struct GemvPushConstants
+    {
+        uint32_t m;
+        uint32_t n;
+        uint32_t lda;
+        uint32_t padding;
+        T alpha;
+        T beta;
+    };
+
+    template<typename T>
+    struct GemmPushConstants
+    {
+        uint32_t m;
+        uint32_t n;
+        uint32_t k;
+        uint32_t lda;
+        uint32_t ldb;
+        uint32_t ldc;
+        T alpha;
+        T beta;
+    };
+
+    void init(SimpleComputeContext& context)
+    {
+        this->context = &context;
+        gemvKernels[0].init(context, "./shaders/gemv.spv");
+        gemvKernels[1].init(context, "./shaders/gemvFloat.spv");
+        gemmKernels[0].init(context, "./shaders/gemm.spv");
+        gemmKernels[1].init(context, "./shaders/gemmFloat.spv");
+        workGroupSize = context.chooseWorkGroupSize(UINT32_MAX);
+        maxGroupCount = context.getDeviceProperties().limits.maxComputeWorkGroupCount[0];
+    }
+
+    //y = alpha * op(A) * x + beta * y, op(A) is m x n and is A or A^T, lda is the column stride of A.
+    //beta == 0 never reads y
+    void recordGemv(vk::CommandBuffer command, ElementType type, bool transposeA, uint32_t m, uint32_t n,
+        double alpha, vk::Buffer matA, uint32_t lda, vk::Buffer x, double beta, vk::Buffer y)
+    {
+        if (m == 0)
+        {
+            return;
+        }
+        requireElementType(type);
+        int kernelIndex = type == ElementType::eFloat ? 1 : 0;
+        vk::Pipeline pipeline = gemvKernels[kernelIndex].pipeline(workGroupSize, { transposeA ? VK_TRUE : VK_FALSE });
+        //a workgroup takes workGroupSize * 4 rows of A, or one output of A^T at a time
+        uint32_t groupCount = transposeA ? std::min(m, maxGroupCount) : (m + workGroupSize * gemvRowsPerInvocation - 1) / (workGroupSize * gemvRowsPerInvocation);
+        if (type == ElementType::eFloat)
+        {
+            GemvPushConstants<float> pushConst{ m, n, lda, 0, static_cast<float>(alpha), static_cast<float>(beta) };
+            gemvKernels[kernelIndex].record(command, pipeline, { kernelArg<float>(matA), kernelArg<float>(x), kernelArg<float>(y) }, pushConst, groupCount);
+        }
+        else
+        {
+            GemvPushConstants<double> pushConst{ m, n, lda, 0, alpha, beta };
+            gemvKernels[kernelIndex].record(command, pipeline, { kernelArg<double>(matA), kernelArg<double>(x), kernelArg<double>(y) }, pushConst, groupCount);
+        }
+    }
+
+    //C = alpha * op(A) * B + beta * C with op(A) m x k and A or A^T, B k x n and C m x n, beta == 0 never reads C
+    void recordGemm(vk::CommandBuffer command, ElementType type, bool transposeA, uint32_t m, uint32_t n, uint32_t k,
+        double alpha, vk::Buffer matA, uint32_t lda, vk::Buffer matB, uint32_t ldb, double beta, vk::Buffer matC, uint32_t ldc)
+    {
+        if (m == 0 || n == 0)
+        {
+            return;
+        }
+        requireElementType(type);
+        int kernelIndex = type == ElementType::eFloat ? 1 : 0;
+        vk::Pipeline pipeline = gemmKernels[kernelIndex].pipeline(gemmThreadCount, { transposeA ? VK_TRUE : VK_FALSE });
+        uint32_t groupCountX = (m + gemmTileSize - 1) / gemmTileSize;
+        uint32_t groupCountY = (n + gemmTileSize - 1) / gemmTileSize;
+        if (type == ElementType::eFloat)
+        {
+            GemmPushConstants<float> pushConst{ m, n, k, lda, ldb, ldc, static_cast<float>(alpha), static_cast<float>(beta) };
+            gemmKernels[kernelIndex].record(command, pipeline, { kernelArg<float>(matA), kernelArg<float>(matB), kernelArg<float>(matC) },
+                pushConst, groupCountX, groupCountY);
+        }
+        else
+        {
+            GemmPushConstants<double> pushConst{ m, n, k, lda, ldb, ldc, alpha, beta };
+            gemmKernels[kernelIndex].record(command, pipeline, { kernelArg<double>(matA), kernelArg<double>(matB), kernelArg<double>(matC) },
+                pushConst, groupCountX, groupCountY);
+        }
+    }
+
+    //A * x for armadillo operands, uploads both, waits for the result and frees the buffers again
+    template<typename T>
+    arma::Col<T> multiply(const arma::Mat<T>& matA, const arma::Col<T>& x)
+    {
+        if (matA.n_cols != x.n_elem)
+        {
+            throw std::runtime_error("gemv operands do not match");
+        }
+        arma::Col<T> result(matA.n_rows);
+        runOnce<T>({ matA.memptr(), x.memptr() }, { matA.n_elem, x.n_elem }, result.memptr(), result.n_elem,
+            [&](vk::CommandBuffer command, const std::vector<vk::Buffer>& buffers)
+        {
+            recordGemv(command, elementTypeOf<T>(), false, static_cast<uint32_t>(matA.n_rows), static_cast<uint32_t>(matA.n_cols),
+                1.0, buffers[0], static_cast<uint32_t>(matA.n_rows), buffers[1], 0.0, buffers[2]);
+        });
+        return result;
+    }
+
+    //A * B for armadillo operands
+    template<typename T>
+    arma::Mat<T> multiply(const arma::Mat<T>& matA, const arma::Mat<T>& matB)
+    {
+        if (matA.n_cols != matB.n_rows)
+        {
+            throw std::runtime_error("gemm operands do not match");
+        }
+        arma::Mat<T> result(matA.n_rows, matB.n_cols);
+        runOnce<T>({ matA.memptr(), matB.memptr() }, { matA.n_elem, matB.n_elem }, result.memptr(), result.n_elem,
+            [&](vk::CommandBuffer command, const std::vector<vk::Buffer>& buffers)
+        {
+            recordGemm(command, elementTypeOf<T>(), false, static_cast<uint32_t>(matA.n_rows), static_cast<uint32_t>(matB.n_cols), static_cast<uint32_t>(matA.n_cols),
+                1.0, buffers[0], static_cast<uint32_t>(matA.n_rows), buffers[1], static_cast<uint32_t>(matB.n_rows), 0.0, buffers[2], static_cast<uint32_t>(matA.n_rows));
+        });
+        return result;
+    }
+
+    //forget descriptor sets of a caller's buffer before destroying it
+    void release(vk::Buffer buffer)
+    {
+        for (auto& i : gemvKernels)
+        {
+            i.release(buffer);
+        }
+        for (auto& i : gemmKernels)
+        {
+            i.release(buffer);
+        }
+    }
+
+    void destroy()
+    {
+        for (auto& i : gemvKernels)
+        {
+            i.destroy();
+        }
+        for (auto& i : gemmKernels)
+        {
+            i.destroy();
+        }
+    }
+private:
+    //must match gemvCommon.glsl and gemmCommon.glsl
+    static constexpr uint32_t gemvRowsPerInvocation = 4;
+    static constexpr uint32_t gemmThreadCount = 64;
+    static constexpr uint32_t gemmTileSize = 32;
+
+    SimpleComputeContext* context = nullptr;
+    //index 0 double, 1 float
+    std::array<ComputeKernel, 2> gemvKernels;
+    std::array<ComputeKernel, 2> gemmKernels;
+    uint32_t workGroupSize = 1;
+    uint32_t maxGroupCount = 1;
+
+    //the double kernels can't even be built without shaderFloat64
+    void requireElementType(ElementType type)const
+    {
+        if (type == ElementType::eDouble && !context->supportsFloat64())
+        {
+            throw std::runtime_error("double GEMV and GEMM need a device with shaderFloat64");
+        }
+    }
+
+    template<typename T>
+    static ElementType elementTypeOf()
+    {
+        static_assert(std::is_same<T, double>::value || std::is_same<T, float>::value, "dense kernels take float or double");
+        return std::is_same<T, float>::value ? ElementType::eFloat : ElementType::eDouble;
+    }
+
+    //uploads the inputs, records with the input buffers and the output buffer last, reads the output back
+    template<typename T>
+    void runOnce(const std::vector<const T*>& inputs, const std::vector<arma::uword>& inputSizes, T* output, arma::uword outputSize,
+        const std::function<void(vk::CommandBuffer, const std::vector<vk::Buffer>&)>& recordWork)
+    {
+        std::vector<vk::Buffer> buffers;
+        std::vector<vk::DeviceMemory> bufferMemorys;
+        for (size_t i = 0; i <= inputs.size(); i++)
+        {
+            arma::uword count = i < inputs.size() ? inputSizes[i] : outputSize;
+            vk::DeviceSize size = std::max<vk::DeviceSize>(count * sizeof(T), sizeof(T));
+            vk::Buffer buffer;
+            vk::DeviceMemory memory;
+            std::tie(buffer, memory) = context->createStorageBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer);
+            if (i < inputs.size() && count > 0)
+            {
+                context->uploadToBuffer(buffer, memory, inputs[i], count * sizeof(T));
+            }
+            buffers.push_back(buffer);
+            bufferMemorys.push_back(memory);
+        }
+
+        vk::Device device = context->getDevice();
+        vk::CommandBufferAllocateInfo commandAllocInfo(context->getCommandPool(), vk::CommandBufferLevel::ePrimary, 1);
+        vk::CommandBuffer command = device.allocateCommandBuffers(commandAllocInfo).front();
+        command.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        recordWork(command, buffers);
+        command.end();
+        vk::Fence fence = device.createFence({});
+        context->submitCompute(command, fence);
+        device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+        context->releaseUploads();
+        context->releaseSemaphores();
+        device.destroyFence(fence);
+        device.freeCommandBuffers(context->getCommandPool(), command);
+
+        if (outputSize > 0)
+        {
+            context->readbackFromBuffer(buffers.back(), bufferMemorys.back(), output, outputSize * sizeof(T));
+        }
+        for (size_t i = 0; i < buffers.size(); i++)
+        {
+            release(buffers[i]);
+            context->destroyBufferAndFreeMemory(buffers[i], bufferMemorys[i]);
+        }
+    }
+};
@@ -0,0 +1,251 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<algorithm>
+#include<cctype>
+#include<cstdlib>
+#include<functional>
+#include<ostream>
+#include<string>
+#include<tuple>
+#include<vector>
+
+//everything device selection looks at, queried once per physical device.
+//the selected one is kept by the context, so memory type lookups and limits never go back to the driver
+struct DeviceInfo
+{
+    vk::PhysicalDevice handle;
+    //position in vkEnumeratePhysicalDevices, what an index override refers to
+    uint32_t index = 0;
+    vk::PhysicalDeviceProperties properties;
+    vk::PhysicalDeviceFeatures features;
+    vk::PhysicalDeviceMemoryProperties memoryProperties;
+    std::vector<vk::QueueFamilyProperties> queueFamilies;
+    std::vector<std::string> extensions;
+    //subgroup properties need Vulkan 1.1 from the instance and the device, all zero otherwise
+    uint32_t subgroupSize = 0;
+    vk::ShaderStageFlags subgroupStages;
+    vk::SubgroupFeatureFlags subgroupOperations;
+    //largest device local heap
+    vk::DeviceSize deviceLocalBytes = 0;
+    //compute families without graphics and transfer only families, they let uploads and async compute overlap
+    uint32_t dedicatedQueueFamilies = 0;
+
+    inline std::string name()const { return properties.deviceName; }
+
+    bool hasExtension(const std::string& extension)const
+    {
+        return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+    }
+
+    bool hasQueueFamily(vk::QueueFlags flags)const
+    {
+        return std::any_of(queueFamilies.begin(), queueFamilies.end(),
+            [flags](const vk::QueueFamilyProperties& i) { return i.queueCount > 0 && (i.queueFlags & flags) == flags; });
+    }
+};
+
+//ranks the physical devices of an instance and picks the best one meeting a context's requirements.
+//the ranking is device type first, then fp64, device local memory, dedicated queue families and subgroup size,
+//TRYVULKAN_DEVICE or preferredDevice() overrides it with a device index or a part of the device name
+class DeviceSelector
+{
+public:
+    struct Requirements
+    {
+        vk::QueueFlags queueFlags = vk::QueueFlagBits::eCompute;
+        bool float64 = false;
+        std::vector<std::string> extensions;
+        //anything else a context needs, such as presenting to its surface, returns an empty string when the device is fine
+        std::function<std::string(const DeviceInfo&)> check;
+    };
+
+    //index or case insensitive part of the device name, starts as TRYVULKAN_DEVICE, set it before creating a context
+    static std::string& preferredDevice()
+    {
+        static std::string preferred = readEnvironment("TRYVULKAN_DEVICE");
+        return preferred;
+    }
+
+    static DeviceInfo query(vk::PhysicalDevice physicalDevice, uint32_t index, uint32_t instanceApiVersion)
+    {
+        DeviceInfo info;
+        info.handle = physicalDevice;
+        info.index = index;
+        info.properties = physicalDevice.getProperties();
+        info.features = physicalDevice.getFeatures();
+        info.memoryProperties = physicalDevice.getMemoryProperties();
+        info.queueFamilies = physicalDevice.getQueueFamilyProperties();
+        for (const auto& i : physicalDevice.enumerateDeviceExtensionProperties())
+        {
+            info.extensions.push_back(i.extensionName);
+        }
+        if (instanceApiVersion >= VK_API_VERSION_1_1 && info.properties.apiVersion >= VK_API_VERSION_1_1)
+        {
+            auto properties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceSubgroupProperties>();
+            const vk::PhysicalDeviceSubgroupProperties& subgroup = properties.get<vk::PhysicalDeviceSubgroupProperties>();
+            info.subgroupSize = subgroup.subgroupSize;
+            info.subgroupStages = subgroup.supportedStages;
+            info.subgroupOperations = subgroup.supportedOperations;
+        }
+        for (uint32_t i = 0; i < info.memoryProperties.memoryHeapCount; i++)
+        {
+            const vk::MemoryHeap& heap = info.memoryProperties.memoryHeaps[i];
+            if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+            {
+                info.deviceLocalBytes = std::max(info.deviceLocalBytes, heap.size);
+            }
+        }
+        for (const auto& i : info.queueFamilies)
+        {
+            bool asyncCompute = (i.queueFlags & vk::QueueFlagBits::eCompute) && !(i.queueFlags & vk::QueueFlagBits::eGraphics);
+            bool transferOnly = (i.queueFlags & vk::QueueFlagBits::eTransfer) && !(i.queueFlags & (vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics));
+            if (i.queueCount > 0 && (asyncCompute || transferOnly))
+            {
+                info.dedicatedQueueFamilies++;
+            }
+        }
+        return info;
+    }
+
+    //every device of the instance, best first
+    static std::vector<DeviceInfo> enumerate(vk::Instance instance, uint32_t instanceApiVersion)
+    {
+        std::vector<vk::PhysicalDevice> physicalDevices = instance.enumeratePhysicalDevices();
+        std::vector<DeviceInfo> devices;
+        for (uint32_t i = 0; i < physicalDevices.size(); i++)
+        {
+            devices.push_back(query(physicalDevices[i], i, instanceApiVersion));
+        }
+        std::stable_sort(devices.begin(), devices.end(), ranksAbove);
+        return devices;
+    }
+
+    //empty when the device meets the requirements, otherwise the first one it misses
+    static std::string unmetRequirement(const DeviceInfo& device, const Requirements& requirements)
+    {
+        if (!device.hasQueueFamily(requirements.queueFlags))
+        {
+            return "no queue family with " + vk::to_string(requirements.queueFlags);
+        }
+        if (requirements.float64 && !device.features.shaderFloat64)
+        {
+            return "no shaderFloat64";
+        }
+        for (const auto& i : requirements.extensions)
+        {
+            if (!device.hasExtension(i))
+            {
+                return "no " + i;
+            }
+        }
+        return requirements.check ? requirements.check(device) : std::string();
+    }
+
+    //the override when one is set, the best ranked suitable device otherwise
+    static DeviceInfo select(vk::Instance instance, uint32_t instanceApiVersion, const Requirements& requirements)
+    {
+        std::vector<DeviceInfo> devices = enumerate(instance, instanceApiVersion);
+        const std::string& preferred = preferredDevice();
+        if (!preferred.empty())
+        {
+            for (const auto& i : devices)
+            {
+                if (matches(i, preferred))
+                {
+                    std::string unmet = unmetRequirement(i, requirements);
+                    if (!unmet.empty())
+                    {
+                        throw std::runtime_error("requested device " + i.name() + " is not usable: " + unmet);
+                    }
+                    return i;
+                }
+            }
+            throw std::runtime_error("no physical device matches " + preferred);
+        }
+        for (const auto& i : devices)
+        {
+            if (unmetRequirement(i, requirements).empty())
+            {
+                return i;
+            }
+        }
+        throw std::runtime_error("no suitable physical device");
+    }
+
+    //one line per device in ranked order, the selected one marked with *
+    static void print(std::ostream& out, const std::vector<DeviceInfo>& devices, const Requirements& requirements, vk::PhysicalDevice selected = {})
+    {
+        for (const auto& i : devices)
+        {
+            std::string unmet = unmetRequirement(i, requirements);
+            out << (i.handle == selected ? "* " : "  ") << i.index << ": " << i.name()
+                << ", " << vk::to_string(i.properties.deviceType)
+                << ", fp64 " << (i.features.shaderFloat64 ? "yes" : "no")
+                << ", " << (i.deviceLocalBytes >> 20) << " MiB device local"
+                << ", " << i.dedicatedQueueFamilies << " dedicated queue families"
+                << ", subgroup " << i.subgroupSize
+                << (unmet.empty() ? std::string() : ", unusable: " + unmet) << '\n';
+        }
+    }
+
+    static bool ranksAbove(const DeviceInfo& a, const DeviceInfo& b)
+    {
+        //whole GiB, so small heap differences don't outrank the queue families
+        auto key = [](const DeviceInfo& i)
+        {
+            return std::make_tuple(typeRank(i.properties.deviceType), i.features.shaderFloat64 ? 1 : 0,
+                i.deviceLocalBytes >> 30, i.dedicatedQueueFamilies, i.subgroupSize);
+        };
+        return key(a) > key(b);
+    }
+private:
+    static int typeRank(vk::PhysicalDeviceType type)
+    {
+        switch (type)
+        {
+        case vk::PhysicalDeviceType::eDiscreteGpu:
+            return 4;
+        case vk::PhysicalDeviceType::eIntegratedGpu:
+            return 3;
+        case vk::PhysicalDeviceType::eVirtualGpu:
+            return 2;
+        case vk::PhysicalDeviceType::eCpu:
+            return 1;
+        default:
+            return 0;
+        }
+    }
+
+    //all digits is an index, anything else a part of the name
+    static bool matches(const DeviceInfo& device, const std::string& preferred)
+    {
+        if (std::all_of(preferred.begin(), preferred.end(), [](char c) { return std::isdigit(static_cast<unsigned char>(c)) != 0; }))
+        {
+            return device.index == static_cast<uint32_t>(std::stoul(preferred));
+        }
+        auto lower = [](std::string text)
+        {
+            std::transform(text.begin(), text.end(), text.begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+            return text;
+        };
+        return lower(device.name()).find(lower(preferred)) != std::string::npos;
+    }
+
+    static std::string readEnvironment(const char* variable)
+    {
+#ifdef _MSC_VER
+        char* value = nullptr;
+        size_t length = 0;
+        std::string result;
+        if (_dupenv_s(&value, &length, variable) == 0 && value != nullptr)
+        {
+            result = value;
+            free(value);
+        }
+        return result;
+#else
+        const char* value = std::getenv(variable);
+        return value != nullptr ? value : "";
+#endif
+    }
+};
@@ -0,0 +1,160 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<algorithm>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+
+//out = result(combine(unaryX(x), unaryY(y))), clamped to [lower, upper] when clamp is set.
+//the enum values are the specialization constants of shaders/elementwise.comp
+struct ElementwiseOp
+{
+    enum class Combine :uint32_t
+    {
+        eScale = 0,//alpha * x
+        eAxpy = 1,//alpha * x + y
+        eAxpby = 2,//alpha * x + beta * y
+        eMultiply = 3,//x * y
+        eFma = 4,//x * y + out
+        eAdd = 5,
+        eSubtract = 6,
+        eDivide = 7,
+        eMin = 8,
+        eMax = 9,
+        eFirst = 10//x, for plain unary maps
+    };
+    enum class Unary :uint32_t
+    {
+        eIdentity = 0,
+        eNegate = 1,
+        eAbs = 2,
+        eSquare = 3,
+        eSqrt = 4,
+        eReciprocal = 5
+    };
+
+    Combine combine = Combine::eFirst;
+    Unary unaryX = Unary::eIdentity;
+    Unary unaryY = Unary::eIdentity;
+    Unary result = Unary::eIdentity;
+    bool clamp = false;
+    double alpha = 1.0;
+    double beta = 0.0;
+    double lower = 0.0;
+    double upper = 0.0;
+
+    //specialization constants 1 to 5 of the kernel
+    std::vector<uint32_t> constants()const
+    {
+        return { static_cast<uint32_t>(combine), static_cast<uint32_t>(unaryX), static_cast<uint32_t>(unaryY),
+            static_cast<uint32_t>(result), clamp ? VK_TRUE : VK_FALSE };
+    }
+};
+
+//elementwise double kernels over buffers of a SimpleComputeContext, four elements per load and a grid stride loop,
+//so one dispatch of a capped workgroup count streams a vector of any length at memory bandwidth.
+//every record call only records the dispatch, barriers between dependent calls are up to the caller
+class ElementwiseKernels
+{
+public:
+    struct PushConstants
+    {
+        uint32_t count;
+        uint32_t padding;
+        double alpha;
+        double beta;
+        double lower;
+        double upper;
+    };
+
+    void init(SimpleComputeContext& context)
+    {
+        kernel.init(context, "./shaders/elementwise.spv");
+        workGroupSize = context.chooseWorkGroupSize(UINT32_MAX);
+        maxGroupCount = std::min(context.getDeviceProperties().limits.maxComputeWorkGroupCount[0], groupCountCap);
+    }
+
+    //out = op(x, y) over the first count doubles, y is only read by binary ops and may be any buffer otherwise
+    void record(vk::CommandBuffer command, const ElementwiseOp& op, vk::Buffer x, vk::Buffer y, vk::Buffer out, uint32_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        PushConstants pushConst{ count, 0, op.alpha, op.beta, op.lower, op.upper };
+        uint32_t vectorCount = std::max(1u, count / 4);
+        uint32_t groupCount = std::min(maxGroupCount, (vectorCount + workGroupSize - 1) / workGroupSize);
+        kernel.record(command, kernel.pipeline(workGroupSize, op.constants()), { kernelArg<double>(x), kernelArg<double>(y), kernelArg<double>(out) }, pushConst, groupCount);
+    }
+
+    //out = alpha * x
+    void recordScale(vk::CommandBuffer command, double alpha, vk::Buffer x, vk::Buffer out, uint32_t count)
+    {
+        ElementwiseOp op;
+        op.combine = ElementwiseOp::Combine::eScale;
+        op.alpha = alpha;
+        record(command, op, x, x, out, count);
+    }
+
+    //y = alpha * x + y
+    void recordAxpy(vk::CommandBuffer command, double alpha, vk::Buffer x, vk::Buffer y, uint32_t count)
+    {
+        ElementwiseOp op;
+        op.combine = ElementwiseOp::Combine::eAxpy;
+        op.alpha = alpha;
+        record(command, op, x, y, y, count);
+    }
+
+    //out = alpha * x + beta * y
+    void recordAxpby(vk::CommandBuffer command, double alpha, vk::Buffer x, double beta, vk::Buffer y, vk::Buffer out, uint32_t count)
+    {
+        ElementwiseOp op;
+        op.combine = ElementwiseOp::Combine::eAxpby;
+        op.alpha = alpha;
+        op.beta = beta;
+        record(command, op, x, y, out, count);
+    }
+
+    //out += x * y with a single rounding
+    void recordFma(vk::CommandBuffer command, vk::Buffer x, vk::Buffer y, vk::Buffer out, uint32_t count)
+    {
+        ElementwiseOp op;
+        op.combine = ElementwiseOp::Combine::eFma;
+        record(command, op, x, y, out, count);
+    }
+
+    //out = min(max(x, lower), upper)
+    void recordClamp(vk::CommandBuffer command, double lower, double upper, vk::Buffer x, vk::Buffer out, uint32_t count)
+    {
+        ElementwiseOp op;
+        op.clamp = true;
+        op.lower = lower;
+        op.upper = upper;
+        record(command, op, x, x, out, count);
+    }
+
+    //out = f(x)
+    void recordMap(vk::CommandBuffer command, ElementwiseOp::Unary f, vk::Buffer x, vk::Buffer out, uint32_t count)
+    {
+        ElementwiseOp op;
+        op.unaryX = f;
+        record(command, op, x, x, out, count);
+    }
+
+    //forget descriptor sets of a caller's buffer before destroying it
+    void release(vk::Buffer buffer)
+    {
+        kernel.release(buffer);
+    }
+
+    void destroy()
+    {
+        kernel.destroy();
+    }
+private:
+    //enough resident workgroups for current GPUs, the grid stride loop covers the rest
+    static constexpr uint32_t groupCountCap = 1024;
+
+    ComputeKernel kernel;
+    uint32_t workGroupSize = 1;
+    uint32_t maxGroupCount = groupCountCap;
+};
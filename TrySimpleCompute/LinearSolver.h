@@ -0,0 +1,29 @@
+#pragma once
+#include<armadillo>
+
+//what the last run did, filled in by run()
+struct SolveReport
+{
+    int iterations = 0;
+    bool converged = false;
+};
+
+//common front end of the Vulkan solvers and the CPU backend, one system per init/run/destroy cycle
+class LinearSolver
+{
+public:
+    virtual ~LinearSolver() = default;
+
+    virtual void init(const arma::sp_mat& matA, const arma::vec& b) = 0;
+    //dense systems go through the sparse path unless a solver has its own dense storage
+    virtual void init(const arma::mat& matA, const arma::vec& b)
+    {
+        init(arma::sp_mat(matA), b);
+    }
+    virtual arma::vec run() = 0;
+    virtual void destroy() = 0;
+
+    inline const SolveReport& getReport()const { return report; }
+protected:
+    SolveReport report;
+};
@@ -0,0 +1,655 @@
+#pragma once
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include<Windows.h>
+//collides with vk::MemoryBarrier, vulkan.hpp undefines it the same way
+#ifdef MemoryBarrier
+#undef MemoryBarrier
+#endif
+#else
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+#endif
+#include<armadillo>
+#include<fstream>
+#include<sstream>
+#include<string>
+#include<vector>
+#include<algorithm>
+#include<limits>
+#include<stdexcept>
+#include<cstdlib>
+#include<cstring>
+#include<cctype>
+#include<fmt/format.h>
+#include"CsrMatrix.h"
+#include"ThreadPool.h"
+
+//read only view of a whole file, the pages are loaded by the os on first touch
+class MappedFile
+{
+public:
+    void open(const std::string& path)
+    {
+#ifdef _WIN32
+        fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("can't open " + path);
+        }
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(fileHandle, &fileSize);
+        size = static_cast<size_t>(fileSize.QuadPart);
+        if (size == 0)
+        {
+            close();
+            throw std::runtime_error(path + " is empty");
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mappingHandle == nullptr)
+        {
+            close();
+            throw std::runtime_error("can't map " + path);
+        }
+        mapped = static_cast<const char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+#else
+        fileDescriptor = ::open(path.c_str(), O_RDONLY);
+        if (fileDescriptor < 0)
+        {
+            throw std::runtime_error("can't open " + path);
+        }
+        struct stat fileStat;
+        fstat(fileDescriptor, &fileStat);
+        size = static_cast<size_t>(fileStat.st_size);
+        if (size == 0)
+        {
+            close();
+            throw std::runtime_error(path + " is empty");
+        }
+        void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        mapped = view == MAP_FAILED ? nullptr : static_cast<const char*>(view);
+        if (mapped != nullptr)
+        {
+            madvise(view, size, MADV_SEQUENTIAL);
+        }
+#endif
+        if (mapped == nullptr)
+        {
+            close();
+            throw std::runtime_error("can't map " + path);
+        }
+    }
+
+    inline const char* data()const { return mapped; }
+    inline size_t fileSize()const { return size; }
+
+    void close()
+    {
+#ifdef _WIN32
+        if (mapped != nullptr)
+        {
+            UnmapViewOfFile(mapped);
+        }
+        if (mappingHandle != nullptr)
+        {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(fileHandle);
+        }
+        mappingHandle = nullptr;
+        fileHandle = INVALID_HANDLE_VALUE;
+#else
+        if (mapped != nullptr)
+        {
+            munmap(const_cast<char*>(mapped), size);
+        }
+        if (fileDescriptor >= 0)
+        {
+            ::close(fileDescriptor);
+        }
+        fileDescriptor = -1;
+#endif
+        mapped = nullptr;
+        size = 0;
+    }
+private:
+#ifdef _WIN32
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#else
+    int fileDescriptor = -1;
+#endif
+    const char* mapped = nullptr;
+    size_t size = 0;
+};
+
+//native problem file: a header, the values, the optional right hand side, then for csr the column indices and row offsets.
+//dense matrices are stored row major, so a mapped file can be copied into a staging buffer as is
+class BinaryMatrixFile
+{
+public:
+    enum class Storage :uint32_t
+    {
+        eDenseRowMajor = 0,
+        eCsr = 1
+    };
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        Storage storage;
+        uint32_t hasRightHandSide;
+        uint64_t nRows;
+        uint64_t nCols;
+        uint64_t nonZeros;
+    };
+
+    static constexpr uint32_t fileMagic = 0x584d5654;//"TVMX"
+    static constexpr uint32_t fileVersion = 1;
+
+    void open(const std::string& path)
+    {
+        file.open(path);
+        if (file.fileSize() < sizeof(FileHeader))
+        {
+            file.close();
+            throw std::runtime_error(path + " is too short for a matrix file");
+        }
+        memcpy(&header, file.data(), sizeof(FileHeader));
+        if (header.magic != fileMagic || header.version != fileVersion ||
+            (header.storage != Storage::eDenseRowMajor && header.storage != Storage::eCsr))
+        {
+            file.close();
+            throw std::runtime_error(path + " is not a matrix file of this version");
+        }
+        bool csr = header.storage == Storage::eCsr;
+        if (csr && (header.nRows > std::numeric_limits<uint32_t>::max() || header.nonZeros > std::numeric_limits<uint32_t>::max()))
+        {
+            file.close();
+            throw std::runtime_error(path + " is too large for 32 bit indices");
+        }
+        if (!csr && header.nonZeros != header.nRows * header.nCols)
+        {
+            file.close();
+            throw std::runtime_error(path + " has a dense header with the wrong element count");
+        }
+        uint64_t expectedSize = sizeof(FileHeader) + header.nonZeros * sizeof(double);
+        expectedSize += header.hasRightHandSide ? header.nRows * sizeof(double) : 0;
+        expectedSize += csr ? header.nonZeros * sizeof(uint32_t) + (header.nRows + 1) * sizeof(uint32_t) : 0;
+        if (expectedSize != file.fileSize())
+        {
+            file.close();
+            throw std::runtime_error(path + " is truncated or has trailing data");
+        }
+        if (csr)
+        {
+            validateCsr(path);
+        }
+    }
+
+    inline const FileHeader& getHeader()const { return header; }
+    inline bool isDense()const { return header.storage == Storage::eDenseRowMajor; }
+
+    //row major elements of a dense file or the nonzeros of a csr file
+    inline const double* values()const { return reinterpret_cast<const double*>(file.data() + sizeof(FileHeader)); }
+
+    //nullptr when the file has no right hand side
+    inline const double* rightHandSide()const
+    {
+        return header.hasRightHandSide ? values() + header.nonZeros : nullptr;
+    }
+
+    inline const uint32_t* colIdx()const
+    {
+        return reinterpret_cast<const uint32_t*>(values() + header.nonZeros + (header.hasRightHandSide ? header.nRows : 0));
+    }
+
+    inline const uint32_t* rowPtr()const { return colIdx() + header.nonZeros; }
+
+    //copies a csr file into the layout the sparse kernels read
+    CsrMatrix toCsr()const
+    {
+        if (isDense())
+        {
+            throw std::runtime_error("dense matrix file read as csr");
+        }
+        CsrMatrix result;
+        result.n_rows = static_cast<uint32_t>(header.nRows);
+        result.n_cols = static_cast<uint32_t>(header.nCols);
+        result.rowPtr.assign(rowPtr(), rowPtr() + header.nRows + 1);
+        result.colIdx.assign(colIdx(), colIdx() + header.nonZeros);
+        result.values.assign(values(), values() + header.nonZeros);
+        return result;
+    }
+
+    void close()
+    {
+        file.close();
+    }
+private:
+    MappedFile file;
+    FileHeader header{};
+
+    //the kernels index with these without bounds checks, so a corrupt file is rejected before anything reads it
+    void validateCsr(const std::string& path)
+    {
+        const uint32_t* offsets = rowPtr();
+        const uint32_t* columns = colIdx();
+        bool valid = offsets[0] == 0 && offsets[header.nRows] == header.nonZeros;
+        for (uint64_t row = 0; valid && row < header.nRows; row++)
+        {
+            valid = offsets[row] <= offsets[row + 1];
+        }
+        for (uint64_t k = 0; valid && k < header.nonZeros; k++)
+        {
+            valid = columns[k] < header.nCols;
+        }
+        if (!valid)
+        {
+            file.close();
+            throw std::runtime_error(path + " has row offsets or column indices outside the matrix");
+        }
+    }
+};
+
+//writes a dense matrix row by row, b may be nullptr
+inline void saveBinaryMatrix(const std::string& path, const arma::mat& mat, const double* b = nullptr)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("can't write " + path);
+    }
+    BinaryMatrixFile::FileHeader header{ BinaryMatrixFile::fileMagic, BinaryMatrixFile::fileVersion, BinaryMatrixFile::Storage::eDenseRowMajor,
+        b != nullptr, mat.n_rows, mat.n_cols, mat.n_elem };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<double> row(mat.n_cols);
+    for (arma::uword i = 0; i < mat.n_rows; i++)
+    {
+        for (arma::uword j = 0; j < mat.n_cols; j++)
+        {
+            row[j] = mat(i, j);
+        }
+        file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(double));
+    }
+    if (b != nullptr)
+    {
+        file.write(reinterpret_cast<const char*>(b), mat.n_rows * sizeof(double));
+    }
+    if (!file)
+    {
+        throw std::runtime_error("can't write " + path);
+    }
+}
+
+inline void saveBinaryMatrix(const std::string& path, const CsrMatrix& mat, const double* b = nullptr)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("can't write " + path);
+    }
+    BinaryMatrixFile::FileHeader header{ BinaryMatrixFile::fileMagic, BinaryMatrixFile::fileVersion, BinaryMatrixFile::Storage::eCsr,
+        b != nullptr, mat.n_rows, mat.n_cols, mat.nonZeros() };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mat.values.data()), mat.values.size() * sizeof(double));
+    if (b != nullptr)
+    {
+        file.write(reinterpret_cast<const char*>(b), mat.n_rows * sizeof(double));
+    }
+    file.write(reinterpret_cast<const char*>(mat.colIdx.data()), mat.colIdx.size() * sizeof(uint32_t));
+    file.write(reinterpret_cast<const char*>(mat.rowPtr.data()), mat.rowPtr.size() * sizeof(uint32_t));
+    if (!file)
+    {
+        throw std::runtime_error("can't write " + path);
+    }
+}
+
+//forward only reader over a range of mapped text, never reads past end
+struct TextCursor
+{
+    const char* pos;
+    const char* end;
+
+    inline bool atEnd()const { return pos >= end; }
+
+    //skips spaces and tabs but stops at the end of the line
+    void skipSpaces()
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r'))
+        {
+            pos++;
+        }
+    }
+
+    //moves to the first character after the next newline
+    void skipLine()
+    {
+        while (pos < end && *pos != '\n')
+        {
+            pos++;
+        }
+        if (pos < end)
+        {
+            pos++;
+        }
+    }
+
+    uint64_t readUnsigned()
+    {
+        skipSpaces();
+        if (pos >= end || *pos < '0' || *pos > '9')
+        {
+            throw std::runtime_error("matrix market: expected an index");
+        }
+        uint64_t value = 0;
+        while (pos < end && *pos >= '0' && *pos <= '9')
+        {
+            value = value * 10 + static_cast<uint64_t>(*pos - '0');
+            pos++;
+        }
+        return value;
+    }
+
+    //the mapped text is not null terminated, so the token is copied before strtod sees it
+    double readDouble()
+    {
+        skipSpaces();
+        char token[64];
+        size_t length = 0;
+        while (pos < end && length + 1 < sizeof(token) && *pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '\n')
+        {
+            token[length++] = *pos++;
+        }
+        token[length] = '\0';
+        char* parsedEnd = nullptr;
+        double value = std::strtod(token, &parsedEnd);
+        if (length == 0 || parsedEnd != token + length)
+        {
+            throw std::runtime_error("matrix market: expected a number");
+        }
+        return value;
+    }
+
+    std::string readLine()
+    {
+        const char* lineBegin = pos;
+        skipLine();
+        const char* lineEnd = pos;
+        while (lineEnd > lineBegin && (lineEnd[-1] == '\n' || lineEnd[-1] == '\r'))
+        {
+            lineEnd--;
+        }
+        return std::string(lineBegin, lineEnd);
+    }
+};
+
+//reads a Matrix Market file into csr storage, the entries are parsed on every worker of the pool.
+//coordinate and array formats with real, integer or pattern fields and general, symmetric or skew-symmetric structure,
+//coordinate entries listed more than once are summed
+inline CsrMatrix loadMatrixMarket(const std::string& path, ThreadPool& pool)
+{
+    struct Triplet
+    {
+        uint32_t row;
+        uint32_t col;
+        double value;
+    };
+
+    MappedFile file;
+    file.open(path);
+    TextCursor header{ file.data(), file.data() + file.fileSize() };
+
+    std::string tag, object, format, field, symmetry;
+    std::istringstream banner(header.readLine());
+    banner >> tag >> object >> format >> field >> symmetry;
+    for (auto i : { &object, &format, &field, &symmetry })
+    {
+        std::transform(i->begin(), i->end(), i->begin(), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    }
+    if (tag != "%%MatrixMarket" || object != "matrix" || (format != "coordinate" && format != "array"))
+    {
+        file.close();
+        throw std::runtime_error(path + " is not a Matrix Market matrix");
+    }
+    if (field == "complex" || symmetry == "hermitian")
+    {
+        file.close();
+        throw std::runtime_error(path + " is complex, only real matrices are supported");
+    }
+    bool coordinate = format == "coordinate";
+    bool pattern = field == "pattern";
+    bool symmetric = symmetry == "symmetric";
+    bool skew = symmetry == "skew-symmetric";
+
+    //comments run until the size line
+    header.skipSpaces();
+    while (!header.atEnd() && (*header.pos == '%' || *header.pos == '\n'))
+    {
+        header.skipLine();
+        header.skipSpaces();
+    }
+    uint64_t nRows = header.readUnsigned();
+    uint64_t nCols = header.readUnsigned();
+    uint64_t declaredEntries = coordinate ? header.readUnsigned() : nRows * nCols;
+    header.skipLine();
+    if (nRows > std::numeric_limits<uint32_t>::max() || nCols > std::numeric_limits<uint32_t>::max())
+    {
+        file.close();
+        throw std::runtime_error(path + " is too large for 32 bit indices");
+    }
+
+    //every worker takes a slice of the body that starts and ends on a line boundary
+    unsigned workerCount = pool.size();
+    std::vector<const char*> sliceBegins(workerCount + 1, header.end);
+    size_t bodySize = header.end - header.pos;
+    sliceBegins[0] = header.pos;
+    for (unsigned i = 1; i < workerCount; i++)
+    {
+        TextCursor split{ header.pos + bodySize * i / workerCount, header.end };
+        if (split.pos[-1] != '\n')
+        {
+            split.skipLine();
+        }
+        sliceBegins[i] = std::max(split.pos, sliceBegins[i - 1]);
+    }
+
+    std::vector<std::vector<Triplet>> workerTriplets(workerCount);
+    std::vector<std::vector<double>> workerValues(workerCount);
+    std::vector<uint64_t> workerEntries(workerCount, 0);
+    std::vector<std::string> workerErrors(workerCount);
+    pool.run([&](unsigned worker)
+    {
+        TextCursor cursor{ sliceBegins[worker], sliceBegins[worker + 1] };
+        try
+        {
+            while (true)
+            {
+                cursor.skipSpaces();
+                if (cursor.atEnd())
+                {
+                    break;
+                }
+                if (*cursor.pos == '\n' || *cursor.pos == '%')
+                {
+                    cursor.skipLine();
+                    continue;
+                }
+                workerEntries[worker]++;
+                if (!coordinate)
+                {
+                    workerValues[worker].push_back(cursor.readDouble());
+                    cursor.skipLine();
+                    continue;
+                }
+                uint64_t row = cursor.readUnsigned();
+                uint64_t col = cursor.readUnsigned();
+                double value = pattern ? 1.0 : cursor.readDouble();
+                cursor.skipLine();
+                if (row == 0 || row > nRows || col == 0 || col > nCols)
+                {
+                    throw std::runtime_error("matrix market: entry outside the matrix");
+                }
+                Triplet entry{ static_cast<uint32_t>(row - 1), static_cast<uint32_t>(col - 1), value };
+                workerTriplets[worker].push_back(entry);
+                if ((symmetric || skew) && row != col)
+                {
+                    workerTriplets[worker].push_back({ entry.col, entry.row, skew ? -value : value });
+                }
+            }
+        }
+        catch (const std::exception& e)
+        {
+            workerErrors[worker] = e.what();
+        }
+    });
+    file.close();
+    for (const auto& i : workerErrors)
+    {
+        if (!i.empty())
+        {
+            throw std::runtime_error(path + ": " + i);
+        }
+    }
+
+    //array files list the columns in order, symmetric ones only the lower triangle, slices are concatenated in order
+    if (!coordinate)
+    {
+        if (symmetric || skew)
+        {
+            declaredEntries = skew ? nCols * (nCols - 1) / 2 : nCols * (nCols + 1) / 2;
+        }
+        uint64_t entry = 0;
+        uint64_t row = skew ? 1 : 0;
+        uint64_t col = 0;
+        std::vector<Triplet>& triplets = workerTriplets[0];
+        for (const auto& slice : workerValues)
+        {
+            for (double value : slice)
+            {
+                if (entry == declaredEntries)
+                {
+                    break;
+                }
+                entry++;
+                if (value != 0.0)
+                {
+                    triplets.push_back({ static_cast<uint32_t>(row), static_cast<uint32_t>(col), value });
+                    if ((symmetric || skew) && row != col)
+                    {
+                        triplets.push_back({ static_cast<uint32_t>(col), static_cast<uint32_t>(row), skew ? -value : value });
+                    }
+                }
+                if (++row == nRows)
+                {
+                    col++;
+                    row = symmetric ? col : skew ? col + 1 : 0;
+                }
+            }
+        }
+    }
+
+    uint64_t parsedEntries = 0;
+    uint64_t storedEntries = 0;
+    for (unsigned i = 0; i < workerCount; i++)
+    {
+        parsedEntries += workerEntries[i];
+        storedEntries += workerTriplets[i].size();
+    }
+    if (parsedEntries != declaredEntries)
+    {
+        throw std::runtime_error(fmt::format("{} declares {} entries but has {}", path, declaredEntries, parsedEntries));
+    }
+    if (storedEntries > std::numeric_limits<uint32_t>::max())
+    {
+        throw std::runtime_error(path + " has too many nonzeros for 32 bit indices");
+    }
+
+    //counting sort by row, then every worker sorts the columns of its own rows
+    CsrMatrix result;
+    result.n_rows = static_cast<uint32_t>(nRows);
+    result.n_cols = static_cast<uint32_t>(nCols);
+    result.rowPtr.assign(result.n_rows + 1, 0);
+    for (const auto& triplets : workerTriplets)
+    {
+        for (const auto& i : triplets)
+        {
+            result.rowPtr[i.row + 1]++;
+        }
+    }
+    for (uint32_t row = 0; row < result.n_rows; row++)
+    {
+        result.rowPtr[row + 1] += result.rowPtr[row];
+    }
+    result.colIdx.resize(storedEntries);
+    result.values.resize(storedEntries);
+    std::vector<uint32_t> nextSlot(result.rowPtr.begin(), result.rowPtr.end() - 1);
+    for (auto& triplets : workerTriplets)
+    {
+        for (const auto& i : triplets)
+        {
+            uint32_t slot = nextSlot[i.row]++;
+            result.colIdx[slot] = i.col;
+            result.values[slot] = i.value;
+        }
+        std::vector<Triplet>().swap(triplets);
+    }
+    //duplicates are summed while the row is written back, rowLengths keeps what is left of every row
+    std::vector<uint32_t> rowLengths(result.n_rows);
+    pool.run([&](unsigned worker)
+    {
+        std::vector<std::pair<uint32_t, double>> rowEntries;
+        for (uint32_t row = worker; row < result.n_rows; row += workerCount)
+        {
+            uint32_t rowBegin = result.rowPtr[row];
+            uint32_t rowEnd = result.rowPtr[row + 1];
+            rowEntries.clear();
+            for (uint32_t k = rowBegin; k < rowEnd; k++)
+            {
+                rowEntries.emplace_back(result.colIdx[k], result.values[k]);
+            }
+            std::sort(rowEntries.begin(), rowEntries.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+            uint32_t k = rowBegin;
+            for (size_t i = 0; i < rowEntries.size(); i++)
+            {
+                if (k > rowBegin && result.colIdx[k - 1] == rowEntries[i].first)
+                {
+                    result.values[k - 1] += rowEntries[i].second;
+                    continue;
+                }
+                result.colIdx[k] = rowEntries[i].first;
+                result.values[k] = rowEntries[i].second;
+                k++;
+            }
+            rowLengths[row] = k - rowBegin;
+        }
+    });
+
+    //rows only shrink, so moving every row to its new start never overwrites one that is still to be moved
+    uint32_t merged = 0;
+    for (uint32_t row = 0; row < result.n_rows; row++)
+    {
+        uint32_t rowBegin = result.rowPtr[row];
+        if (merged != rowBegin)
+        {
+            std::copy(result.colIdx.begin() + rowBegin, result.colIdx.begin() + rowBegin + rowLengths[row], result.colIdx.begin() + merged);
+            std::copy(result.values.begin() + rowBegin, result.values.begin() + rowBegin + rowLengths[row], result.values.begin() + merged);
+        }
+        result.rowPtr[row] = merged;
+        merged += rowLengths[row];
+    }
+    result.rowPtr[result.n_rows] = merged;
+    result.colIdx.resize(merged);
+    result.values.resize(merged);
+    return result;
+}
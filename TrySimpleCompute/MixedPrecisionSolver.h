@@ -0,0 +1,239 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<array>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+#include"CsrMatrix.h"
+#include"LinearSolver.h"
+
+//iterative refinement: Jacobi sweeps in float on a float copy of A solve for a correction,
+//the residual and the accumulated solution stay in double so the result keeps double accuracy
+class MixedPrecisionSolver :public LinearSolver, protected SimpleComputeContext
+{
+public:
+    struct PushConstants
+    {
+        int32_t nRows;
+    };
+private:
+    CsrMatrix A;
+
+    vk::Buffer rowPtrBuffer;
+    vk::DeviceMemory rowPtrBufferMemory;
+    vk::Buffer colIdxBuffer;
+    vk::DeviceMemory colIdxBufferMemory;
+    vk::Buffer valuesBuffer;
+    vk::DeviceMemory valuesBufferMemory;
+    vk::Buffer floatValuesBuffer;
+    vk::DeviceMemory floatValuesBufferMemory;
+
+    vk::Buffer vectorBBuffer;
+    vk::DeviceMemory vectorBBufferMemory;
+    vk::Buffer vectorXBuffer;
+    vk::DeviceMemory vectorXBufferMemory;
+    vk::Buffer residualBuffer;
+    vk::DeviceMemory residualBufferMemory;
+    //sweep i reads correctionBuffers[i % 2] and writes the other one
+    std::array<vk::Buffer, 2> correctionBuffers;
+    std::array<vk::DeviceMemory, 2> correctionBufferMemorys;
+    //largest |r| of every workgroup, read by the host after each outer iteration
+    vk::Buffer partialsBuffer;
+    vk::DeviceMemory partialsBufferMemory;
+
+    ComputeKernel residualKernel;
+    ComputeKernel jacobiKernel;
+    ComputeKernel correctKernel;
+    vk::Pipeline residualPipeline;
+    vk::Pipeline jacobiPipeline;
+    vk::Pipeline correctPipeline;
+    std::vector<KernelArg> residualArgs;
+    //sweep i uses jacobiArgs[i % 2]
+    std::array<std::vector<KernelArg>, 2> jacobiArgs;
+    std::vector<KernelArg> correctArgs;
+    vk::CommandBuffer refineCommandBuffer;
+
+    uint32_t workGroupSize = 1;
+    uint32_t groupCount = 1;
+    int innerSweeps = 16;
+    int maxOuterIterations = 50;
+    double tolerance = 1e-10;
+    double maxB = 0.0;
+
+    std::tuple<vk::Buffer, vk::DeviceMemory> sendToGPU(const void* data, vk::DeviceSize size)
+    {
+        auto result = createStorageBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer);
+        uploadToBuffer(std::get<0>(result), std::get<1>(result), data, size);
+        return result;
+    }
+
+    void recordResidual(vk::CommandBuffer commandBuffer)
+    {
+        PushConstants pushConst{ static_cast<int32_t>(A.n_rows) };
+        residualKernel.record(commandBuffer, residualPipeline, residualArgs, pushConst, groupCount);
+        //the host reads the partials, the next outer iteration reads the residual
+        vk::MemoryBarrier residualToNext(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead | vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost | vk::PipelineStageFlagBits::eComputeShader, {}, residualToNext, {}, {});
+    }
+
+    double readMaxResidual()
+    {
+        const double* partials = static_cast<const double*>(device.mapMemory(partialsBufferMemory, 0, groupCount * sizeof(double)));
+        double result = *std::max_element(partials, partials + groupCount);
+        device.unmapMemory(partialsBufferMemory);
+        return result;
+    }
+public:
+    using SimpleComputeContext::MemoryPolicy;
+    using SimpleComputeContext::setMemoryPolicy;
+    using SimpleComputeContext::enableTimestamps;
+    using SimpleComputeContext::getTimestampRecords;
+    using SimpleComputeContext::printTimestampLog;
+
+    //float Jacobi sweeps per outer iteration, rounded up to an even number
+    void setInnerSweeps(int sweeps)
+    {
+        innerSweeps = std::max(2, sweeps + sweeps % 2);
+    }
+
+    //stops once max |b - A * x| <= tolerance * max |b|
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    void setMaxOuterIterations(int iterations)
+    {
+        maxOuterIterations = iterations;
+    }
+
+    using LinearSolver::init;
+
+    void init(const arma::sp_mat& matA, const arma::vec& b) override
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != b.n_elem)
+        {
+            throw std::runtime_error("mixed precision solver needs a square matrix matching b");
+        }
+        A = CsrMatrix::fromArma(matA);
+        A.requireNonzeroDiagonal();
+        maxB = arma::abs(b).max();
+
+        workGroupSize = chooseWorkGroupSize(A.n_rows);
+        groupCount = (A.n_rows + workGroupSize - 1) / workGroupSize;
+
+        std::vector<float> floatValues(A.values.begin(), A.values.end());
+        arma::vec assumeX(b.n_elem, arma::fill::zeros);
+        vk::DeviceSize sizeOfx = b.n_elem * sizeof(double);
+        vk::DeviceSize sizeOfFloatx = b.n_elem * sizeof(float);
+        std::tie(rowPtrBuffer, rowPtrBufferMemory) = sendToGPU(A.rowPtr.data(), A.rowPtr.size() * sizeof(uint32_t));
+        std::tie(colIdxBuffer, colIdxBufferMemory) = sendToGPU(A.colIdx.data(), A.colIdx.size() * sizeof(uint32_t));
+        std::tie(valuesBuffer, valuesBufferMemory) = sendToGPU(A.values.data(), A.values.size() * sizeof(double));
+        std::tie(floatValuesBuffer, floatValuesBufferMemory) = sendToGPU(floatValues.data(), floatValues.size() * sizeof(float));
+        std::tie(vectorBBuffer, vectorBBufferMemory) = sendToGPU(b.memptr(), sizeOfx);
+        std::tie(vectorXBuffer, vectorXBufferMemory) = sendToGPU(assumeX.memptr(), sizeOfx);
+        std::tie(residualBuffer, residualBufferMemory) = createStorageBuffer(sizeOfFloatx, vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(correctionBuffers[0], correctionBufferMemorys[0]) = createStorageBuffer(sizeOfFloatx, vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(correctionBuffers[1], correctionBufferMemorys[1]) = createStorageBuffer(sizeOfFloatx, vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(partialsBuffer, partialsBufferMemory) = createHostBuffer(groupCount * sizeof(double), vk::BufferUsageFlagBits::eStorageBuffer);
+
+        residualKernel.init(*this, "./shaders/refineResidual.spv");
+        jacobiKernel.init(*this, "./shaders/refineJacobi.spv");
+        correctKernel.init(*this, "./shaders/refineCorrect.spv");
+        residualPipeline = residualKernel.pipeline(workGroupSize);
+        jacobiPipeline = jacobiKernel.pipeline(workGroupSize);
+        correctPipeline = correctKernel.pipeline(workGroupSize);
+
+        KernelArg rowPtr = kernelArg<uint32_t>(rowPtrBuffer);
+        KernelArg colIdx = kernelArg<uint32_t>(colIdxBuffer);
+        KernelArg x = kernelArg<double>(vectorXBuffer);
+        KernelArg residual = kernelArg<float>(residualBuffer);
+        std::array<KernelArg, 2> corrections{ kernelArg<float>(correctionBuffers[0]), kernelArg<float>(correctionBuffers[1]) };
+        residualArgs = { rowPtr, colIdx, kernelArg<double>(valuesBuffer), kernelArg<double>(vectorBBuffer), x, residual, corrections[0],
+            kernelArg<double>(partialsBuffer) };
+        for (int i = 0; i < 2; i++)
+        {
+            jacobiArgs[i] = { rowPtr, colIdx, kernelArg<float>(floatValuesBuffer), residual, corrections[i], corrections[1 - i] };
+        }
+        correctArgs = { x, corrections[0] };
+
+        PushConstants pushConst{ static_cast<int32_t>(A.n_rows) };
+        //the first residual is b itself, it also clears the correction
+        vk::CommandBuffer firstResidual = beginSingleTimeCommand();
+        recordResidual(firstResidual);
+        endSingleTimeCommand(firstResidual);
+
+        //one outer iteration: inner float sweeps, x += e, new residual.
+        //timed, it is a batch of innerSweeps iterations and the correction and residual count to the last one
+        if (timestampsEnabled())
+        {
+            timestampGroupsPerBatch(static_cast<uint32_t>(innerSweeps) + 2);
+        }
+        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        refineCommandBuffer = device.allocateCommandBuffers(commandAllocInfo).front();
+        refineCommandBuffer.begin(vk::CommandBufferBeginInfo{});
+        beginTimestamps(refineCommandBuffer);
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        for (int i = 0; i < innerSweeps; i++)
+        {
+            jacobiKernel.record(refineCommandBuffer, jacobiPipeline, jacobiArgs[i % 2], pushConst, groupCount);
+            refineCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+            writeTimestamp(refineCommandBuffer, i, "float sweep");
+        }
+        //an even number of sweeps leaves the correction in correctionBuffers[0]
+        correctKernel.record(refineCommandBuffer, correctPipeline, correctArgs, pushConst, groupCount);
+        refineCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+        writeTimestamp(refineCommandBuffer, innerSweeps - 1, "correct");
+        recordResidual(refineCommandBuffer);
+        writeTimestamp(refineCommandBuffer, innerSweeps - 1, "residual");
+        refineCommandBuffer.end();
+    }
+
+    arma::vec run() override
+    {
+        double maxResidual = readMaxResidual();
+        int outerIterations = 0;
+        while (maxResidual > tolerance * maxB && outerIterations < maxOuterIterations)
+        {
+            submitCompute(refineCommandBuffer, {});
+            queue.waitIdle();
+            //the first pass waits on the uploads of init, free them and their semaphores once it is done
+            releaseUploads();
+            releaseSemaphores();
+            maxResidual = readMaxResidual();
+            if (timestampsEnabled())
+            {
+                collectTimestamps(maxResidual);
+            }
+            outerIterations++;
+        }
+        //counted in float sweeps, the work of one outer iteration is dominated by them
+        report.iterations = outerIterations * innerSweeps;
+        report.converged = maxResidual <= tolerance * maxB;
+        fmt::print("mixed precision {} after {} outer iterations ({} float sweeps), max residual {:e}\n",
+            report.converged ? "converged" : "did not converge", outerIterations, report.iterations, maxResidual);
+
+        arma::vec result(A.n_rows);
+        readbackFromBuffer(vectorXBuffer, vectorXBufferMemory, result.memptr(), A.n_rows * sizeof(double));
+        return result;
+    }
+
+    void destroy() override
+    {
+        destroyBufferAndFreeMemory(rowPtrBuffer, rowPtrBufferMemory);
+        destroyBufferAndFreeMemory(colIdxBuffer, colIdxBufferMemory);
+        destroyBufferAndFreeMemory(valuesBuffer, valuesBufferMemory);
+        destroyBufferAndFreeMemory(floatValuesBuffer, floatValuesBufferMemory);
+        destroyBufferAndFreeMemory(vectorBBuffer, vectorBBufferMemory);
+        destroyBufferAndFreeMemory(vectorXBuffer, vectorXBufferMemory);
+        destroyBufferAndFreeMemory(residualBuffer, residualBufferMemory);
+        destroyBufferAndFreeMemory(correctionBuffers[0], correctionBufferMemorys[0]);
+        destroyBufferAndFreeMemory(correctionBuffers[1], correctionBufferMemorys[1]);
+        destroyBufferAndFreeMemory(partialsBuffer, partialsBufferMemory);
+        residualKernel.destroy();
+        jacobiKernel.destroy();
+        correctKernel.destroy();
+        device.freeCommandBuffers(commandPool, refineCommandBuffer);
+    }
+};
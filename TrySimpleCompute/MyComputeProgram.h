@@ -0,0 +1,624 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<algorithm>
+#include<array>
+#include<chrono>
+#include<cmath>
+#include<cstring>
+#include<iostream>
+#include<random>
+#include<string>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"ConvergenceCheck.h"
+#include"ComputeKernel.h"
+#include"MatrixLoader.h"
+#include"DenseKernels.h"
+
+//the dense Jacobi solver of the demo, jacobi.comp over a random system, a problem file or a given system
+class MyComputeProgram :protected SimpleComputeContext
+{
+public:
+    //how A is laid out in the storage buffer
+    enum class MatrixLayout
+    {
+        eColumnMajor,//armadillo's own order, every lane of a row reads with a stride of n doubles
+        eRowMajor//consecutive lanes read consecutive doubles
+    };
+private:
+    //systems up to this size are printed
+    static constexpr arma::uword printLimit = 16;
+    //right hand sides one invocation of jacobiMultiRhs.comp keeps in registers
+    static constexpr uint32_t maxRhsPerGroup = 8;
+
+    //most checks of plain Jacobi rounds the spectral radius estimate runs before the Chebyshev rounds start
+    static constexpr int estimationChecks = 8;
+    //two successive per round ratios closer than this, relative to the ratio, count as settled
+    static constexpr double estimationSettled = 1e-3;
+    //the estimate comes from a finite number of rounds and may be slightly low, an upper bound that is too small diverges
+    static constexpr double radiusMargin = 1.05;
+    //the Chebyshev weights converge geometrically, rounds after the last stored one reuse it
+    static constexpr arma::uword maxChebyshevWeights = 4096;
+
+    //both Jacobi kernels take these, jacobi.comp ignores rhsCount and jacobiMultiRhs.comp rowOffset
+    struct JacobiPushConstants
+    {
+        int32_t nCols;
+        int32_t rhsCount;
+        int32_t rowOffset;
+    };
+
+    //chebyshevJacobi.comp
+    struct ChebyshevPushConstants
+    {
+        int32_t nCols;
+        uint32_t checkInterval;
+        uint32_t roundInCheck;
+        uint32_t firstCheck;
+        uint32_t weightCount;
+        uint32_t padding;
+        double gamma;
+    };
+
+    arma::mat A;
+    arma::mat b;
+    arma::mat solutionX;
+    //set by setSystem, solved instead of the random system and not printed
+    bool givenSystem = false;
+    SolverStatus lastStatus{};
+    arma::mat lastResult;
+
+    vk::Buffer matrixABuffer;
+    vk::DeviceMemory matrixBufferMemory;
+
+    vk::Buffer vectorBBuffer;
+    vk::DeviceMemory vectorBBufferMemory;
+
+    //round i reads iterateBuffers[i % 2] and writes the other one
+    std::array<vk::Buffer, 2> iterateBuffers;
+    std::array<vk::DeviceMemory, 2> iterateBufferMemorys;
+
+    //omega of every Chebyshev round
+    vk::Buffer weightsBuffer;
+    vk::DeviceMemory weightsBufferMemory;
+
+    ComputeKernel jacobiKernel;
+    ConvergenceCheck convergenceCheck;
+    DenseKernels denseKernels;
+
+    vk::CommandBuffer batchCommandBuffer;
+
+    uint32_t workGroupSize = 1;
+    arma::uword matrixSize = 10;
+    arma::uword rhsCount = 1;
+    MatrixLayout matrixLayout = MatrixLayout::eColumnMajor;
+    int maxRounds = 0;
+    int calcRounds = 1;
+    int roundsPerBatch = 0;
+    int batchCount = 1;
+    int checkInterval = 16;
+    double tolerance = 1e-10;
+    std::string problemPath;
+    bool useChebyshev = false;
+    //bounds on the eigenvalues of D^-1 * A, estimated when upper <= 0
+    double eigenvalueLower = 0.0;
+    double eigenvalueUpper = 0.0;
+
+    std::tuple<vk::Buffer, vk::DeviceMemory> sendMatrixToGPU(const arma::mat& matToSend, vk::BufferUsageFlags usage, MatrixLayout layout = MatrixLayout::eColumnMajor)
+    {
+        vk::DeviceSize matSize = matToSend.n_elem * sizeof(double);
+        auto result = createStorageBuffer(matSize, usage);
+        if (layout == MatrixLayout::eRowMajor)
+        {
+            //the column major storage of the transpose is the row major storage of the matrix
+            arma::mat transposed = matToSend.t();
+            uploadToBuffer(std::get<0>(result), std::get<1>(result), transposed.memptr(), matSize);
+        }
+        else
+        {
+            uploadToBuffer(std::get<0>(result), std::get<1>(result), matToSend.memptr(), matSize);
+        }
+        return result;
+    }
+public:
+    using SimpleComputeContext::MemoryPolicy;
+    using SimpleComputeContext::setMemoryPolicy;
+    using SimpleComputeContext::enableTimestamps;
+    using SimpleComputeContext::getTimestampRecords;
+    using SimpleComputeContext::printTimestampLog;
+
+    MyComputeProgram()
+    {
+    }
+
+    ~MyComputeProgram()
+    {
+    }
+
+    //number of Jacobi rounds recorded into one command buffer, 0 records every round into a single submission
+    void setRoundsPerBatch(int rounds)
+    {
+        roundsPerBatch = rounds;
+    }
+
+    //largest change of any unknown between two iterates that counts as converged
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    //convergence is tested every interval rounds, rounded up to an even number
+    void setCheckInterval(int interval)
+    {
+        checkInterval = std::max(2, interval + interval % 2);
+    }
+
+    //number of unknowns of the random test system
+    void setMatrixSize(arma::uword size)
+    {
+        matrixSize = size;
+    }
+
+    void setMatrixLayout(MatrixLayout layout)
+    {
+        matrixLayout = layout;
+    }
+
+    //dense binary problem file used instead of the random system, empty generates one
+    void setProblemFile(const std::string& path)
+    {
+        problemPath = path;
+    }
+
+    //number of right hand sides of the random system, b and x become n x count and every round reads A once for all of them
+    void setRightHandSideCount(arma::uword count)
+    {
+        rhsCount = std::max<arma::uword>(1, count);
+    }
+
+    //Chebyshev acceleration of the Jacobi rounds for a single right hand side.
+    //lower and upper bound the eigenvalues of D^-1 * A, which must be real and positive, e.g. for a symmetric positive definite A.
+    //upper <= 0 estimates them as 1 -+ the spectral radius of D^-1 * R, measured by a few plain Jacobi rounds
+    void setChebyshev(bool enabled, double lower = 0.0, double upper = 0.0)
+    {
+        useChebyshev = enabled;
+        eigenvalueLower = lower;
+        eigenvalueUpper = upper;
+    }
+
+    //upper bound on the number of rounds, 0 uses 5 * n
+    void setMaxRounds(int rounds)
+    {
+        maxRounds = rounds;
+    }
+
+    //solves this system instead of a random one, starting from x = 0
+    void setSystem(const arma::mat& matA, const arma::vec& vectorB)
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != vectorB.n_elem)
+        {
+            throw std::runtime_error("dense jacobi needs a square matrix matching b");
+        }
+        A = matA;
+        b = vectorB;
+        givenSystem = true;
+    }
+
+    //b = A * solutionX with the A already on the device, b stays there and is read back for printing and checking.
+    //row major storage is A^T in column major terms, so that layout multiplies with the transposed GEMV or GEMM
+    void computeRightHandSide()
+    {
+        uint32_t n = static_cast<uint32_t>(A.n_rows);
+        uint32_t rhs = static_cast<uint32_t>(solutionX.n_cols);
+        vk::Buffer solutionBuffer;
+        vk::DeviceMemory solutionBufferMemory;
+        std::tie(solutionBuffer, solutionBufferMemory) = sendMatrixToGPU(solutionX, vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(vectorBBuffer, vectorBBufferMemory) = createStorageBuffer(solutionX.n_elem * sizeof(double), vk::BufferUsageFlagBits::eStorageBuffer);
+
+        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        vk::CommandBuffer command = device.allocateCommandBuffers(commandAllocInfo).front();
+        command.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        bool transposeA = matrixLayout == MatrixLayout::eRowMajor;
+        if (rhs == 1)
+        {
+            denseKernels.recordGemv(command, DenseKernels::ElementType::eDouble, transposeA, n, n,
+                1.0, matrixABuffer, n, solutionBuffer, 0.0, vectorBBuffer);
+        }
+        else
+        {
+            denseKernels.recordGemm(command, DenseKernels::ElementType::eDouble, transposeA, n, rhs, n,
+                1.0, matrixABuffer, n, solutionBuffer, n, 0.0, vectorBBuffer, n);
+        }
+        command.end();
+        vk::Fence fence = device.createFence({});
+        submitCompute(command, fence);
+        device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+        releaseUploads();
+        releaseSemaphores();
+        device.destroyFence(fence);
+        device.freeCommandBuffers(commandPool, command);
+
+        b = arma::mat(n, rhs);
+        readbackFromBuffer(vectorBBuffer, vectorBBufferMemory, b.memptr(), b.n_elem * sizeof(double));
+        denseKernels.release(solutionBuffer);
+        destroyBufferAndFreeMemory(solutionBuffer, solutionBufferMemory);
+    }
+
+    //random diagonally dominant system, kept on the host to print small ones
+    void createRandomSystem()
+    {
+        //init matrix data
+        std::default_random_engine dre(std::chrono::system_clock::now().time_since_epoch().count());
+        std::uniform_real_distribution<double> uid(0.1, 20.0);
+
+        A = arma::mat(matrixSize, matrixSize);
+        solutionX = arma::mat(matrixSize, rhsCount);
+        A.imbue([&dre, uid] {return uid(dre); });
+        for (int i = 0; i < A.n_rows; i++)
+        {
+            auto row = A.row(i);
+            double temp = 0.0;
+            for (auto k = row.begin(); k != row.end(); k++)
+            {
+                temp += *k;
+            }
+            row[i] = temp + 3.0;
+        }
+        solutionX.imbue([&dre, uid] {return uid(dre); });
+        std::tie(matrixABuffer, matrixBufferMemory) = sendMatrixToGPU(A, vk::BufferUsageFlagBits::eStorageBuffer, matrixLayout);
+        computeRightHandSide();
+        arma::mat assumeX(b.n_rows, b.n_cols);
+        assumeX.imbue([&dre, uid] {return 10; });
+
+        //print equation
+        if (b.n_rows <= printLimit)
+        {
+            fmt::print("equation :\n");
+            for (size_t i = 0; i < b.n_rows; i++)
+            {
+                auto rowOfA = A.row(i);
+                fmt::print("{:>10.4f} * x0", rowOfA[0]);
+                for (size_t j = 1; j < rowOfA.n_elem; j++)
+                {
+                    fmt::print(" + {:>10.4f} * x{}", rowOfA[j], j);
+                }
+                fmt::print(" = {:>10.4f}", b(i, 0));
+                for (size_t j = 1; j < b.n_cols; j++)
+                {
+                    fmt::print(", {:>10.4f}", b(i, j));
+                }
+                fmt::print("\n");
+            }
+        }
+
+        std::tie(iterateBuffers[0], iterateBufferMemorys[0]) = sendMatrixToGPU(assumeX, vk::BufferUsageFlagBits::eStorageBuffer);
+    }
+
+    //A, b and a zero start of the system set by setSystem
+    void uploadGivenSystem()
+    {
+        std::tie(matrixABuffer, matrixBufferMemory) = sendMatrixToGPU(A, vk::BufferUsageFlagBits::eStorageBuffer, matrixLayout);
+        std::tie(vectorBBuffer, vectorBBufferMemory) = sendMatrixToGPU(b, vk::BufferUsageFlagBits::eStorageBuffer);
+        arma::mat assumeX(b.n_rows, b.n_cols, arma::fill::zeros);
+        std::tie(iterateBuffers[0], iterateBufferMemorys[0]) = sendMatrixToGPU(assumeX, vk::BufferUsageFlagBits::eStorageBuffer);
+    }
+
+    //the mapped rows are copied into the staging buffer as they are, A never exists on the host.
+    //a problem file has a single right hand side
+    void loadProblemFile()
+    {
+        BinaryMatrixFile file;
+        file.open(problemPath);
+        const BinaryMatrixFile::FileHeader& header = file.getHeader();
+        if (!file.isDense() || header.nRows != header.nCols)
+        {
+            file.close();
+            throw std::runtime_error(problemPath + " is not a square dense matrix");
+        }
+        matrixLayout = MatrixLayout::eRowMajor;
+        vk::DeviceSize matSize = header.nonZeros * sizeof(double);
+        std::tie(matrixABuffer, matrixBufferMemory) = createStorageBuffer(matSize, vk::BufferUsageFlagBits::eStorageBuffer);
+        uploadToBuffer(matrixABuffer, matrixBufferMemory, file.values(), matSize);
+        //without a right hand side the system is solved for b = 1
+        b = arma::mat(header.nRows, 1, arma::fill::ones);
+        if (file.rightHandSide() != nullptr)
+        {
+            memcpy(b.memptr(), file.rightHandSide(), b.n_elem * sizeof(double));
+        }
+        file.close();
+
+        arma::mat assumeX(b.n_elem, 1, arma::fill::zeros);
+        std::tie(vectorBBuffer, vectorBBufferMemory) = sendMatrixToGPU(b, vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(iterateBuffers[0], iterateBufferMemorys[0]) = sendMatrixToGPU(assumeX, vk::BufferUsageFlagBits::eStorageBuffer);
+    }
+
+    //omega(k) of the Chebyshev semi-iteration for an iteration matrix with eigenvalues in [-sigma, sigma],
+    //stored until the recurrence settles on its limit 2 / (1 + sqrt(1 - sigma^2))
+    static arma::vec chebyshevWeights(double sigma, arma::uword maxCount)
+    {
+        std::vector<double> weights{ 1.0 };
+        double omega = 2.0 / (2.0 - sigma * sigma);
+        while (weights.size() < maxCount)
+        {
+            weights.push_back(omega);
+            double next = 1.0 / (1.0 - sigma * sigma * omega / 4.0);
+            if (std::abs(next - omega) <= 1e-15 * omega)
+            {
+                break;
+            }
+            omega = next;
+        }
+        return arma::vec(weights);
+    }
+
+    struct RadiusEstimate
+    {
+        double radius;
+        bool settled;
+    };
+
+    //once the slowest mode dominates, plain Jacobi rounds shrink the update by the spectral radius of D^-1 * R per round,
+    //which is power iteration on the update. every check gives one ratio, the estimate is taken once two successive
+    //ratios agree. the rounds advance the iterate, the Chebyshev rounds start from their result
+    RadiusEstimate estimateSpectralRadius(vk::Pipeline pipeline, const std::array<std::vector<KernelArg>, 2>& roundBuffers, ChebyshevPushConstants pushConst)
+    {
+        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        vk::CommandBuffer command = device.allocateCommandBuffers(commandAllocInfo).front();
+        command.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse));
+        beginTimestamps(command);
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        for (int i = 0; i < checkInterval; i++)
+        {
+            pushConst.roundInCheck = i;
+            jacobiKernel.recordIndirect(command, pipeline, roundBuffers[i % 2], pushConst, convergenceCheck.getStatusBuffer());
+            command.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+            writeTimestamp(command, i, "estimate");
+        }
+        convergenceCheck.record(command);
+        writeTimestamp(command, checkInterval - 1, "check");
+        vk::MemoryBarrier computeToHost(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, computeToHost, {}, {});
+        command.end();
+
+        RadiusEstimate estimate{ 0.0, false };
+        double previousNorm = 0.0;
+        for (int i = 0; i < estimationChecks && !estimate.settled; i++)
+        {
+            SolverStatus status = convergenceCheck.runBatches(command, 1);
+            if (status.converged)
+            {
+                break;
+            }
+            if (previousNorm > 0.0)
+            {
+                double radius = std::pow(status.updateNorm / previousNorm, 1.0 / checkInterval);
+                estimate.settled = estimate.radius > 0.0 && std::abs(radius - estimate.radius) <= estimationSettled * radius;
+                estimate.radius = radius;
+            }
+            previousNorm = status.updateNorm;
+        }
+        device.freeCommandBuffers(commandPool, command);
+        return estimate;
+    }
+
+    //uploads the weights and returns the push constants of the Chebyshev rounds,
+    //a system that does not shrink under plain Jacobi or whose estimate does not settle keeps running plain rounds
+    ChebyshevPushConstants setupChebyshev(vk::Pipeline pipeline, const std::array<std::vector<KernelArg>, 2>& roundBuffers, ChebyshevPushConstants pushConst)
+    {
+        double lower = eigenvalueLower;
+        double upper = eigenvalueUpper;
+        if (upper <= 0.0)
+        {
+            RadiusEstimate estimate = estimateSpectralRadius(pipeline, roundBuffers, pushConst);
+            if (convergenceCheck.readStatus().converged)
+            {
+                return pushConst;
+            }
+            fmt::print("estimated spectral radius of D^-1 * R: {:.6f}{}\n", estimate.radius, estimate.settled ? "" : ", not settled");
+            if (!estimate.settled)
+            {
+                fmt::print("the update does not shrink at a steady rate, chebyshev acceleration is off\n");
+                return pushConst;
+            }
+            if (estimate.radius >= 1.0)
+            {
+                fmt::print("plain Jacobi does not converge, chebyshev acceleration is off\n");
+                return pushConst;
+            }
+            //the margin stays below 1, a radius of 1 would put the lower bound at 0
+            double radius = std::min(estimate.radius * radiusMargin, 0.5 * (1.0 + estimate.radius));
+            lower = 1.0 - radius;
+            upper = 1.0 + radius;
+        }
+        if (lower <= 0.0 || upper < lower)
+        {
+            throw std::runtime_error("chebyshev eigenvalue bounds must satisfy 0 < lower <= upper");
+        }
+
+        //the damped Jacobi step y + gamma * (jacobi(y) - y) has its eigenvalues in [-sigma, sigma]
+        pushConst.gamma = 2.0 / (lower + upper);
+        arma::vec weights = chebyshevWeights((upper - lower) / (upper + lower), maxChebyshevWeights);
+        uploadToBuffer(weightsBuffer, weightsBufferMemory, weights.memptr(), weights.n_elem * sizeof(double));
+        pushConst.weightCount = static_cast<uint32_t>(weights.n_elem);
+        //the estimation rounds already ran checks, round 0 of the recurrence starts after them
+        pushConst.firstCheck = convergenceCheck.readStatus().checkCount;
+        return pushConst;
+    }
+
+    void init()
+    {
+        denseKernels.init(*this);
+        if (givenSystem)
+        {
+            uploadGivenSystem();
+        }
+        else if (problemPath.empty())
+        {
+            createRandomSystem();
+        }
+        else
+        {
+            loadProblemFile();
+        }
+        vk::DeviceSize sizeOfx = b.n_elem * sizeof(double);
+        std::tie(iterateBuffers[1], iterateBufferMemorys[1]) = createStorageBuffer(sizeOfx, vk::BufferUsageFlagBits::eStorageBuffer);
+
+        //load compute shader stage, its layouts come from the shader itself
+        uint32_t n = static_cast<uint32_t>(b.n_rows);
+        uint32_t rhs = static_cast<uint32_t>(b.n_cols);
+        uint32_t rowMajor = matrixLayout == MatrixLayout::eRowMajor ? VK_TRUE : VK_FALSE;
+        vk::Pipeline jacobiPipeline;
+        vk::DispatchIndirectCommand roundDispatch{ n, 1, 1 };
+        if (useChebyshev)
+        {
+            if (rhs != 1)
+            {
+                throw std::runtime_error("chebyshev acceleration takes a single right hand side");
+            }
+            jacobiKernel.init(*this, "./shaders/chebyshevJacobi.spv");
+            workGroupSize = chooseWorkGroupSize(n);
+            jacobiPipeline = jacobiKernel.pipeline(workGroupSize, { rowMajor });
+            std::tie(weightsBuffer, weightsBufferMemory) = createStorageBuffer(maxChebyshevWeights * sizeof(double), vk::BufferUsageFlagBits::eStorageBuffer);
+        }
+        else if (rhs == 1)
+        {
+            jacobiKernel.init(*this, "./shaders/jacobi.spv");
+            workGroupSize = chooseWorkGroupSize(n);
+            jacobiPipeline = jacobiKernel.pipeline(workGroupSize, { rowMajor });
+        }
+        else
+        {
+            //every invocation holds one partial sum per right hand side of its group in shared memory
+            uint32_t rhsPerGroup = rhs < maxRhsPerGroup ? rhs : maxRhsPerGroup;
+            uint32_t sharedLimit = getDeviceProperties().limits.maxComputeSharedMemorySize / (rhsPerGroup * sizeof(double));
+            jacobiKernel.init(*this, "./shaders/jacobiMultiRhs.spv");
+            workGroupSize = chooseWorkGroupSize(n, std::min(256u, sharedLimit));
+            jacobiPipeline = jacobiKernel.pipeline(workGroupSize, { rowMajor, rhsPerGroup });
+            roundDispatch.y = (rhs + rhsPerGroup - 1) / rhsPerGroup;
+        }
+
+        //a timed batch or estimate writes a timestamp per round and one per check
+        if (timestampsEnabled())
+        {
+            timestampGroupsPerBatch(static_cast<uint32_t>(checkInterval) + 1);
+        }
+
+        //jacobi rounds are dispatched indirectly from the status buffer, so the convergence check can stop them.
+        //all right hand sides are checked together, the solve stops once the slowest one converged
+        convergenceCheck.init(*this, iterateBuffers[0], iterateBuffers[1], b.n_elem, workGroupSize, roundDispatch, tolerance);
+
+        //A, b, the iterate read and the iterate written, round i reads iterateBuffers[i % 2].
+        //chebyshevJacobi.comp also reads its weights and the round from the status buffer
+        auto roundArgs = [this](int read)
+        {
+            return std::vector<KernelArg>{ kernelArg<double>(matrixABuffer), kernelArg<double>(vectorBBuffer),
+                kernelArg<double>(iterateBuffers[read]), kernelArg<double>(iterateBuffers[1 - read]) };
+        };
+        std::array<std::vector<KernelArg>, 2> roundBuffers{ roundArgs(0), roundArgs(1) };
+        ChebyshevPushConstants chebyshevConst{ static_cast<int32_t>(n), static_cast<uint32_t>(checkInterval), 0, 0, 0, 0, 1.0 };
+        if (useChebyshev)
+        {
+            for (auto& i : roundBuffers)
+            {
+                i.push_back(kernelArg<double>(weightsBuffer));
+                i.push_back(kernelArg<SolverStatus>(convergenceCheck.getStatusBuffer()));
+            }
+            chebyshevConst = setupChebyshev(jacobiPipeline, roundBuffers, chebyshevConst);
+        }
+
+        calcRounds = maxRounds > 0 ? maxRounds : 5 * n;
+        if (roundsPerBatch <= 0 || roundsPerBatch > calcRounds)
+        {
+            roundsPerBatch = calcRounds;
+        }
+        if (timestampsEnabled())
+        {
+            roundsPerBatch = std::min(roundsPerBatch, timestampGroupsPerBatch(static_cast<uint32_t>(checkInterval) + 1) * checkInterval);
+        }
+        //a batch ends on a convergence check, after an even number of rounds the newest iterate is in iterateBuffers[0]
+        //so the same command buffer can be resubmitted as is
+        roundsPerBatch = (roundsPerBatch + checkInterval - 1) / checkInterval * checkInterval;
+        //calcRounds is rounded up to whole batches, the extra rounds only refine the result
+        batchCount = (calcRounds + roundsPerBatch - 1) / roundsPerBatch;
+        calcRounds = batchCount * roundsPerBatch;
+
+        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        batchCommandBuffer = device.allocateCommandBuffers(commandAllocInfo).front();
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+        batchCommandBuffer.begin(beginInfo);
+        beginTimestamps(batchCommandBuffer);
+        const char* roundLabel = useChebyshev ? "chebyshev" : "jacobi";
+        JacobiPushConstants pushConst{ static_cast<int32_t>(n), static_cast<int32_t>(rhs), 0 };
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        for (int i = 0; i < roundsPerBatch; i++)
+        {
+            if (useChebyshev)
+            {
+                chebyshevConst.roundInCheck = i % checkInterval;
+                jacobiKernel.recordIndirect(batchCommandBuffer, jacobiPipeline, roundBuffers[i % 2], chebyshevConst, convergenceCheck.getStatusBuffer());
+            }
+            else
+            {
+                jacobiKernel.recordIndirect(batchCommandBuffer, jacobiPipeline, roundBuffers[i % 2], pushConst, convergenceCheck.getStatusBuffer());
+            }
+            batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+            writeTimestamp(batchCommandBuffer, i, roundLabel);
+
+            if ((i + 1) % checkInterval == 0)
+            {
+                convergenceCheck.record(batchCommandBuffer);
+                writeTimestamp(batchCommandBuffer, i, "check");
+            }
+        }
+        vk::MemoryBarrier computeToHost(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, computeToHost, {}, {});
+        batchCommandBuffer.end();
+    }
+
+    //returns the number of rounds that ran
+    int run()
+    {
+        lastStatus = convergenceCheck.runBatches(batchCommandBuffer, batchCount);
+        int rounds = lastStatus.checkCount * checkInterval;
+        fmt::print("{} after {} rounds, max update {:e}\n",
+            lastStatus.converged ? "converged" : "not converged", rounds, lastStatus.updateNorm);
+
+        //every batch has an even number of rounds, the newest iterate is back in iterateBuffers[0]
+        lastResult = arma::mat(b.n_rows, b.n_cols);
+        readbackFromBuffer(iterateBuffers[0], iterateBufferMemorys[0], lastResult.memptr(), b.n_elem * sizeof(double));
+        if (b.n_rows <= printLimit && !A.is_empty() && !givenSystem)
+        {
+            std::cout << "result :\n" << lastResult;
+            std::cout << "real result :\n" << arma::solve(A, b);
+        }
+        return rounds;
+    }
+
+    //status of the convergence check after the last run
+    inline const SolverStatus& getStatus()const { return lastStatus; }
+    //n x k iterate of the last run
+    inline const arma::mat& getResult()const { return lastResult; }
+
+    void destroy()
+    {
+        //clean up
+        auto destroyBuffer = [this](auto buffer, auto memory)
+        {
+            destroyBufferAndFreeMemory(buffer, memory);
+        };
+
+        destroyBuffer(matrixABuffer, matrixBufferMemory);
+        destroyBuffer(vectorBBuffer, vectorBBufferMemory);
+        destroyBuffer(iterateBuffers[0], iterateBufferMemorys[0]);
+        destroyBuffer(iterateBuffers[1], iterateBufferMemorys[1]);
+        if (useChebyshev)
+        {
+            destroyBuffer(weightsBuffer, weightsBufferMemory);
+        }
+        jacobiKernel.destroy();
+        convergenceCheck.destroy();
+        denseKernels.destroy();
+        device.freeCommandBuffers(commandPool, batchCommandBuffer);
+    }
+};
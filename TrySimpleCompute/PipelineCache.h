@@ -0,0 +1,196 @@
+#pragma once
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include<Windows.h>
+//collides with vk::MemoryBarrier, vulkan.hpp undefines it the same way
+#ifdef MemoryBarrier
+#undef MemoryBarrier
+#endif
+#endif
+#include<vulkan/vulkan.hpp>
+#include<fstream>
+#include<iostream>
+#include<string>
+#include<vector>
+#include<cstdio>
+#include<cstring>
+
+//pipeline cache kept on disk between launches, shared by the compute context and the ReviewBasics renderer.
+//every owner merges the file into its cache before saving, so several contexts add to one file instead of the last one winning.
+//the file starts with a header naming the device and driver the blob was built with,
+//a blob from another device, another driver or with a broken checksum is dropped and the cache starts empty
+class PipelineCache
+{
+public:
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t headerVersion;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint64_t dataSize;
+        uint64_t checksum;
+    };
+
+    static constexpr uint32_t fileMagic = 0x48434c50;//"PLCH"
+    static constexpr uint32_t fileHeaderVersion = 1;
+
+    void init(vk::PhysicalDevice physicalDevice, vk::Device device, const std::string& path = "pipeline.cache")
+    {
+        this->device = device;
+        this->path = path;
+        properties = physicalDevice.getProperties();
+
+        std::vector<char> blob = loadBlob();
+        vk::PipelineCacheCreateInfo cacheInfo({}, blob.size(), blob.data());
+        try
+        {
+            cache = device.createPipelineCache(cacheInfo);
+        }
+        catch (const vk::SystemError& e)
+        {
+            std::cerr << "pipeline cache " << path << " rejected by the driver: " << e.what() << '\n';
+            cache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
+        }
+    }
+
+    inline vk::PipelineCache handle()const { return cache; }
+
+    //merges what the file holds now, e.g. saved by another context of this run, then writes a temporary file that replaces the old one
+    //in a single rename, so a crash while saving leaves the old blob intact. two processes saving at the same moment can still lose
+    //the pipelines only one of them built, they come back on the next save
+    void save()
+    {
+        mergeFile();
+        std::vector<uint8_t> data = device.getPipelineCacheData(cache);
+        FileHeader header = makeHeader(data);
+        std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file)
+            {
+                std::cerr << "can't write pipeline cache " << temporaryPath << '\n';
+                return;
+            }
+            file.write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            if (!file)
+            {
+                std::cerr << "can't write pipeline cache " << temporaryPath << '\n';
+                return;
+            }
+        }
+        if (!replaceFile(temporaryPath, path))
+        {
+            std::cerr << "can't replace pipeline cache " << path << '\n';
+        }
+    }
+
+    //saves the blob before destroying the cache
+    void destroy()
+    {
+        save();
+        device.destroyPipelineCache(cache);
+    }
+private:
+    vk::Device device;
+    vk::PipelineCache cache;
+    vk::PhysicalDeviceProperties properties;
+    std::string path;
+
+    void mergeFile()
+    {
+        std::vector<char> blob = loadBlob();
+        if (blob.empty())
+        {
+            return;
+        }
+        vk::PipelineCache fileCache;
+        try
+        {
+            fileCache = device.createPipelineCache(vk::PipelineCacheCreateInfo({}, blob.size(), blob.data()));
+            device.mergePipelineCaches(cache, fileCache);
+        }
+        catch (const vk::SystemError& e)
+        {
+            std::cerr << "can't merge pipeline cache " << path << ": " << e.what() << '\n';
+        }
+        if (fileCache)
+        {
+            device.destroyPipelineCache(fileCache);
+        }
+    }
+
+    //rename that overwrites an existing target in one step, std::rename fails on an existing target on Windows
+    static bool replaceFile(const std::string& from, const std::string& to)
+    {
+#ifdef _WIN32
+        return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+        return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+    }
+
+    //FNV-1a, only has to catch truncated or damaged files
+    static uint64_t checksum(const uint8_t* data, size_t size)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    FileHeader makeHeader(const std::vector<uint8_t>& data)const
+    {
+        FileHeader header{};
+        header.magic = fileMagic;
+        header.headerVersion = fileHeaderVersion;
+        header.vendorID = properties.vendorID;
+        header.deviceID = properties.deviceID;
+        header.driverVersion = properties.driverVersion;
+        memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+        header.dataSize = data.size();
+        header.checksum = checksum(data.data(), data.size());
+        return header;
+    }
+
+    //returns an empty blob unless the file was written for this device and driver and is intact
+    std::vector<char> loadBlob()const
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            return {};
+        }
+        FileHeader header{};
+        file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
+        if (!file || header.magic != fileMagic || header.headerVersion != fileHeaderVersion)
+        {
+            std::cerr << "pipeline cache " << path << " has no valid header, ignoring it\n";
+            return {};
+        }
+        if (header.vendorID != properties.vendorID || header.deviceID != properties.deviceID || header.driverVersion != properties.driverVersion ||
+            memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) != 0)
+        {
+            std::cerr << "pipeline cache " << path << " was built for another device or driver, ignoring it\n";
+            return {};
+        }
+        std::vector<char> blob{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+        if (blob.size() != header.dataSize || checksum(reinterpret_cast<const uint8_t*>(blob.data()), blob.size()) != header.checksum)
+        {
+            std::cerr << "pipeline cache " << path << " is damaged, ignoring it\n";
+            return {};
+        }
+        return blob;
+    }
+};
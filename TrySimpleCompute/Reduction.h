@@ -0,0 +1,127 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<algorithm>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+
+//one slot of the result buffer, the layout of Partial in shaders/reduceCommon.glsl
+struct ReductionResult
+{
+    double value;
+    uint32_t index;//argmax ops only
+    uint32_t padding;
+};
+
+//sum, dot, L2 norm, max, max-abs and argmax of float or double vectors on the device.
+//results land in slots of a device buffer, so later dispatches can bind getResultBuffer() and read them without a host round trip.
+//uses subgroup arithmetic when the device has it and a shared memory tree otherwise.
+//float inputs are widened and every op accumulates in double, so the device needs shaderFloat64 either way
+class Reduction
+{
+public:
+    enum class Op :uint32_t
+    {
+        eSum = 0,
+        eDot = 1,
+        eNorm2 = 2,
+        eMax = 3,
+        eMaxAbs = 4,
+        eArgMax = 5,//index of the largest element, ties take the lowest index
+        eArgMaxAbs = 6
+    };
+
+    enum class ElementType
+    {
+        eDouble,
+        eFloat
+    };
+
+    struct PushConstants
+    {
+        uint32_t count;
+        uint32_t fromPartials;
+        uint32_t toResult;
+        uint32_t resultIndex;
+    };
+
+    void init(SimpleComputeContext& context, uint32_t resultSlots = 16)
+    {
+        this->context = &context;
+        if (!context.supportsFloat64())
+        {
+            throw std::runtime_error("reductions accumulate in double and need a device with shaderFloat64");
+        }
+        useSubgroups = context.supportsSubgroupArithmetic();
+        kernel.init(context, useSubgroups ? "./shaders/reduceSubgroup.spv" : "./shaders/reduce.spv");
+        workGroupSize = context.chooseWorkGroupSize(UINT32_MAX);
+        //the second pass is a single workgroup, one partial per invocation keeps its loop short
+        maxGroupCount = workGroupSize;
+        slotCount = resultSlots;
+        std::tie(partialsBuffer, partialsBufferMemory) = context.createDeviceBuffer(maxGroupCount * sizeof(ReductionResult), vk::BufferUsageFlagBits::eStorageBuffer);
+        std::tie(resultBuffer, resultBufferMemory) = context.createStorageBuffer(slotCount * sizeof(ReductionResult),
+            vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+    }
+
+    inline bool usesSubgroups()const { return useSubgroups; }
+    inline vk::Buffer getResultBuffer()const { return resultBuffer; }
+
+    //reduces the first count elements of x, and y for eDot, into result slot resultSlot.
+    //waits for earlier compute writes first, so vectors written just before can be reduced directly,
+    //consumers of the result need their own barrier
+    void record(vk::CommandBuffer command, Op op, vk::Buffer x, vk::Buffer y, uint32_t count, uint32_t resultSlot, ElementType type = ElementType::eDouble)
+    {
+        if (resultSlot >= slotCount)
+        {
+            throw std::runtime_error("reduction result slot out of range");
+        }
+        vk::Pipeline pipeline = kernel.pipeline(workGroupSize, { static_cast<uint32_t>(op), type == ElementType::eFloat ? VK_TRUE : VK_FALSE });
+        KernelElement element = type == ElementType::eFloat ? KernelElement::eFloat32 : KernelElement::eFloat64;
+        std::vector<KernelArg> buffers{ KernelArg{ x, element }, KernelArg{ y ? y : x, element },
+            kernelArg<ReductionResult>(partialsBuffer), kernelArg<ReductionResult>(resultBuffer) };
+        uint32_t groupCount = std::max(1u, std::min(maxGroupCount, (count + workGroupSize - 1) / workGroupSize));
+
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+        if (groupCount == 1)
+        {
+            kernel.record(command, pipeline, buffers, PushConstants{ count, 0, 1, resultSlot }, 1);
+            return;
+        }
+        kernel.record(command, pipeline, buffers, PushConstants{ count, 0, 0, 0 }, groupCount);
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+        kernel.record(command, pipeline, buffers, PushConstants{ groupCount, 1, 1, resultSlot }, 1);
+    }
+
+    //copies one slot back, the commands that wrote it must have finished
+    ReductionResult readResult(uint32_t resultSlot)const
+    {
+        ReductionResult result;
+        context->readbackFromBuffer(resultBuffer, resultBufferMemory, &result, sizeof(ReductionResult), resultSlot * sizeof(ReductionResult));
+        return result;
+    }
+
+    //forget descriptor sets of a caller's buffer before destroying it
+    void release(vk::Buffer buffer)
+    {
+        kernel.release(buffer);
+    }
+
+    void destroy()
+    {
+        context->destroyBufferAndFreeMemory(partialsBuffer, partialsBufferMemory);
+        context->destroyBufferAndFreeMemory(resultBuffer, resultBufferMemory);
+        kernel.destroy();
+    }
+private:
+    SimpleComputeContext* context = nullptr;
+    ComputeKernel kernel;
+    bool useSubgroups = false;
+    uint32_t workGroupSize = 1;
+    uint32_t maxGroupCount = 1;
+    uint32_t slotCount = 0;
+
+    vk::Buffer partialsBuffer;
+    vk::DeviceMemory partialsBufferMemory;
+    vk::Buffer resultBuffer;
+    vk::DeviceMemory resultBufferMemory;
+};
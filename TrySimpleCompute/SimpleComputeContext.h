@@ -1,21 +1,110 @@
 #pragma once
 #include<vulkan/vulkan.hpp>
 #include<iostream>
+#include<fstream>
+#include<algorithm>
+#include<array>
+#include<cstring>
+#include<limits>
+#include<cmath>
+#include<vector>
+#include<string>
+#include<map>
+#include"PipelineCache.h"
+#include"DeviceSelector.h"
+
+//gpu time of one timed section of a batch, residual is only known for the last iteration of a batch and NaN otherwise
+struct TimestampRecord
+{
+    uint32_t batch;
+    int iteration;
+    const char* label;
+    double gpuMilliseconds;
+    double residual;
+};
 
 class SimpleComputeContext
 {
 public:
+    //where createStorageBuffer places solver data
+    enum class MemoryPolicy
+    {
+        eAuto,//device local on discrete GPUs, host visible on unified memory devices
+        eHostVisible,
+        eDeviceLocal
+    };
+
+    //a compute family without graphics when the device has one, transfers prefer a family with neither
     uint32_t queueFamilyIndex = 0;
+    uint32_t transferQueueFamilyIndex = 0;
+    bool useValidation = false;
+    //1.1 when the loader has it, for subgroup operations, otherwise 1.0
+    uint32_t apiVersion = VK_API_VERSION_1_0;
+    MemoryPolicy memoryPolicy = MemoryPolicy::eAuto;
+    bool useDeviceLocalMemory = false;
+    //property flags of the memory type every createBuffer allocation landed in,
+    //uploads and readbacks map or stage by these, so a later policy change can't mix them up
+    std::map<vk::DeviceMemory, vk::MemoryPropertyFlags> memoryFlags;
 
     vk::Instance instance;
     vk::PhysicalDevice physicalDevice;
+    //properties, memory types and queue families of physicalDevice, queried once at selection
+    DeviceInfo deviceInfo;
     vk::Device device;
     vk::Queue queue;
     vk::CommandPool commandPool;
+    //the compute queue itself when the device has no separate transfer queue
+    vk::Queue transferQueue;
+    vk::CommandPool transferCommandPool;
     vk::DebugUtilsMessengerCreateInfoEXT debugCreateInfo;
     vk::DebugUtilsMessengerEXT debugMessenger;
+    //loaded from and saved to ./pipeline.cache, so relaunches skip most shader compilation
+    PipelineCache pipelineCache;
+
+    //timestamp queries, only created by enableTimestamps
+    vk::QueryPool timestampPool;
+    uint32_t timestampCapacity = 0;
+    double timestampPeriod = 1.0;
+    uint64_t timestampMask = 0;
+    //iteration and label of every timestamp after the first one in the recorded batch
+    std::vector<std::pair<int, const char*>> timestampMarks;
+    std::vector<TimestampRecord> timestampRecords;
+    uint32_t timedBatches = 0;
+
+    //an asynchronous upload in flight on the transfer queue, freed once its fence signals
+    struct PendingUpload
+    {
+        vk::Fence fence;
+        vk::CommandBuffer command;
+        vk::Buffer stagingBuffer;
+        vk::DeviceMemory stagingMemory;
+    };
+    std::vector<PendingUpload> pendingUploads;
+    //signaled by uploads, the next compute submission waits for them
+    std::vector<vk::Semaphore> uploadSemaphores;
+    //already waited for, destroyed once the compute queue is idle
+    std::vector<vk::Semaphore> waitedSemaphores;
+
+    //validation costs time and needs the SDK layer, benchmarks and headless runners turn it off before creating a context
+    static bool& validationEnabled()
+    {
+        static bool enabled = true;
+        return enabled;
+    }
+
+    //every solver needs doubles, programs that only run float kernels such as the float GEMV and GEMM clear it
+    //before creating a context so devices without fp64 can be picked too
+    static bool& float64Required()
+    {
+        static bool required = true;
+        return required;
+    }
 
     inline vk::Device getDevice()const { return device; }
+    inline vk::PhysicalDevice getPhysicalDevice()const { return physicalDevice; }
+    inline const DeviceInfo& getDeviceInfo()const { return deviceInfo; }
+    inline const vk::PhysicalDeviceProperties& getDeviceProperties()const { return deviceInfo.properties; }
+    inline bool supportsFloat64()const { return deviceInfo.features.shaderFloat64 == VK_TRUE; }
     inline vk::Queue getQueue()const { return queue; }
     inline vk::CommandPool getCommandPool()const { return commandPool; }
 
@@ -23,18 +112,37 @@ public:
     {
         fillDebugCreateInfo();
         createInstance();
-        createDebugCallBack();
+        if (useValidation)
+        {
+            createDebugCallBack();
+        }
         selectPhysicalDevice();
+        selectQueueFamilies();
+        setMemoryPolicy(memoryPolicy);
         createLogicalDevice();
         initQueue();
         createCommandPool();
+        pipelineCache.init(physicalDevice, device);
     }
 
     ~SimpleComputeContext()
     {
+        transferQueue.waitIdle();
+        queue.waitIdle();
+        releaseUploads(true);
+        releaseSemaphores(true);
+        pipelineCache.destroy();
+        if (timestampPool)
+        {
+            device.destroyQueryPool(timestampPool);
+        }
+        device.destroyCommandPool(transferCommandPool);
         device.destroyCommandPool(commandPool);
         device.destroy();
-        destroyDebugCallBack();
+        if (useValidation)
+        {
+            destroyDebugCallBack();
+        }
         instance.destroy();
     }
 
@@ -59,14 +167,35 @@ public:
 
     void createInstance()
     {
+        const char* validationLayer = "VK_LAYER_KHRONOS_validation";
+        auto availableLayers = vk::enumerateInstanceLayerProperties();
+        bool layerAvailable = std::any_of(availableLayers.begin(), availableLayers.end(),
+            [validationLayer](const vk::LayerProperties& i) { return strcmp(i.layerName, validationLayer) == 0; });
+        useValidation = validationEnabled() && layerAvailable;
+
         std::vector<const char*> extensions;
-        extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         std::vector<const char*> layers;
-        layers.push_back("VK_LAYER_KHRONOS_validation");
+        if (useValidation)
+        {
+            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+            layers.push_back(validationLayer);
+        }
+
+        //1.0 loaders have no vkEnumerateInstanceVersion
+        auto enumerateInstanceVersion = reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+        uint32_t loaderVersion = VK_API_VERSION_1_0;
+        if (enumerateInstanceVersion != nullptr)
+        {
+            enumerateInstanceVersion(&loaderVersion);
+        }
+        apiVersion = loaderVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
 
-        vk::ApplicationInfo appInfo("hello compute", VK_MAKE_VERSION(0, 1, 0), "simple compute", VK_MAKE_VERSION(0, 1, 0), VK_API_VERSION_1_0);
+        vk::ApplicationInfo appInfo("hello compute", VK_MAKE_VERSION(0, 1, 0), "simple compute", VK_MAKE_VERSION(0, 1, 0), apiVersion);
         vk::InstanceCreateInfo instanceInfo({}, &appInfo, layers.size(), layers.data(), extensions.size(), extensions.data());
-        instanceInfo.pNext = &debugCreateInfo;
+        if (useValidation)
+        {
+            instanceInfo.pNext = &debugCreateInfo;
+        }
         instance = vk::createInstance(instanceInfo);
     }
 
@@ -96,35 +225,129 @@ public:
         }
     }
 
+    //a device without fp64 is only picked when float64Required is cleared
+    static DeviceSelector::Requirements deviceRequirements()
+    {
+        DeviceSelector::Requirements requirements;
+        requirements.queueFlags = vk::QueueFlagBits::eCompute;
+        requirements.float64 = float64Required();
+        return requirements;
+    }
+
     void selectPhysicalDevice()
     {
-        physicalDevice = instance.enumeratePhysicalDevices().front();
+        deviceInfo = DeviceSelector::select(instance, apiVersion, deviceRequirements());
+        physicalDevice = deviceInfo.handle;
+    }
+
+    void selectQueueFamilies()
+    {
+        const std::vector<vk::QueueFamilyProperties>& families = deviceInfo.queueFamilies;
+        auto findFamily = [&families](vk::QueueFlags required, vk::QueueFlags avoided)->int
+        {
+            for (uint32_t i = 0; i < families.size(); i++)
+            {
+                if (families[i].queueCount > 0 && (families[i].queueFlags & required) == required && !(families[i].queueFlags & avoided))
+                {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        };
+        int computeFamily = findFamily(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics);
+        if (computeFamily < 0)
+        {
+            computeFamily = findFamily(vk::QueueFlagBits::eCompute, {});
+        }
+        if (computeFamily < 0)
+        {
+            throw std::runtime_error("physical device has no compute queue");
+        }
+        //compute queues can always copy, so the compute family is the fallback
+        int transferFamily = findFamily(vk::QueueFlagBits::eTransfer, vk::QueueFlagBits::eCompute | vk::QueueFlagBits::eGraphics);
+        queueFamilyIndex = static_cast<uint32_t>(computeFamily);
+        transferQueueFamilyIndex = transferFamily < 0 ? queueFamilyIndex : static_cast<uint32_t>(transferFamily);
+    }
+
+    //subgroup add/min/max in compute shaders, needs Vulkan 1.1 from the loader and the device
+    bool supportsSubgroupArithmetic()const
+    {
+        //the selector leaves the subgroup fields empty below 1.1
+        return (deviceInfo.subgroupStages & vk::ShaderStageFlagBits::eCompute) &&
+            (deviceInfo.subgroupOperations & vk::SubgroupFeatureFlagBits::eArithmetic);
+    }
+
+    bool isUnifiedMemoryDevice()const
+    {
+        vk::PhysicalDeviceType deviceType = deviceInfo.properties.deviceType;
+        return deviceType == vk::PhysicalDeviceType::eIntegratedGpu || deviceType == vk::PhysicalDeviceType::eCpu;
+    }
+
+    //only affects buffers created afterwards
+    void setMemoryPolicy(MemoryPolicy policy)
+    {
+        memoryPolicy = policy;
+        switch (policy)
+        {
+        case MemoryPolicy::eHostVisible:
+            useDeviceLocalMemory = false;
+            break;
+        case MemoryPolicy::eDeviceLocal:
+            useDeviceLocalMemory = true;
+            break;
+        default:
+            useDeviceLocalMemory = !isUnifiedMemoryDevice();
+            break;
+        }
+    }
+
+    //a second queue of the compute family serves transfers when there is no transfer family but the family has room
+    uint32_t transferQueueIndex()const
+    {
+        if (transferQueueFamilyIndex != queueFamilyIndex)
+        {
+            return 0;
+        }
+        return deviceInfo.queueFamilies[queueFamilyIndex].queueCount > 1 ? 1 : 0;
     }
 
     void createLogicalDevice()
     {
-        float queuePriority = 1.0f;
-        vk::DeviceQueueCreateInfo queueInfo({}, queueFamilyIndex, 1, &queuePriority);
+        std::array<float, 2> queuePriorities{ 1.0f,1.0f };
+        std::vector<vk::DeviceQueueCreateInfo> queueInfos;
+        if (transferQueueFamilyIndex != queueFamilyIndex)
+        {
+            queueInfos.push_back({ {}, queueFamilyIndex, 1, queuePriorities.data() });
+            queueInfos.push_back({ {}, transferQueueFamilyIndex, 1, queuePriorities.data() });
+        }
+        else
+        {
+            queueInfos.push_back({ {}, queueFamilyIndex, transferQueueIndex() + 1, queuePriorities.data() });
+        }
+        //enabled whenever the device has it, float only contexts may run on devices without
         vk::PhysicalDeviceFeatures physicalDeviceFeatures;
-        physicalDeviceFeatures.shaderFloat64 = VK_TRUE;
-        vk::DeviceCreateInfo deviceInfo({}, 1, &queueInfo, 0, nullptr, 0, nullptr, &physicalDeviceFeatures);
+        physicalDeviceFeatures.shaderFloat64 = supportsFloat64() ? VK_TRUE : VK_FALSE;
+        vk::DeviceCreateInfo deviceInfo({}, static_cast<uint32_t>(queueInfos.size()), queueInfos.data(), 0, nullptr, 0, nullptr, &physicalDeviceFeatures);
         device = physicalDevice.createDevice(deviceInfo);
     }
 
     void initQueue()
     {
         queue = device.getQueue(queueFamilyIndex, 0);
+        transferQueue = device.getQueue(transferQueueFamilyIndex, transferQueueIndex());
     }
 
     void createCommandPool()
     {
         vk::CommandPoolCreateInfo commandPoolInfo({}, queueFamilyIndex);
         commandPool = device.createCommandPool(commandPoolInfo);
+        vk::CommandPoolCreateInfo transferCommandPoolInfo({}, transferQueueFamilyIndex);
+        transferCommandPool = device.createCommandPool(transferCommandPoolInfo);
     }
 
     uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties)const
     {
-        vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
+        const vk::PhysicalDeviceMemoryProperties& memoryProperties = deviceInfo.memoryProperties;
         for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
         {
             bool memoryTypeSupport = typeFilter & (1 << i);
@@ -137,33 +360,455 @@ public:
         throw std::runtime_error("no memory type supported.");
     }
 
-    std::tuple<vk::Buffer, vk::DeviceMemory> createHostBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage)
+    //buffers are shared concurrently by the compute and transfer families, so no ownership transfers are needed
+    std::tuple<vk::Buffer, vk::DeviceMemory> createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties)
     {
+        std::array<uint32_t, 2> families{ queueFamilyIndex,transferQueueFamilyIndex };
+        bool shared = transferQueueFamilyIndex != queueFamilyIndex;
         vk::BufferCreateInfo bufferInfo(
             {},
             size,
             usage,
-            vk::SharingMode::eExclusive,
-            1,
-            &queueFamilyIndex);
+            shared ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
+            shared ? 2 : 1,
+            families.data());
         vk::Buffer buffer = device.createBuffer(bufferInfo);
         vk::MemoryRequirements requirements = device.getBufferMemoryRequirements(buffer);
-        vk::MemoryAllocateInfo allocInfo(
-            requirements.size,
-            findMemoryType(
-                requirements.memoryTypeBits,
-                vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible));
+        uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+        vk::MemoryAllocateInfo allocInfo(requirements.size, memoryType);
         vk::DeviceMemory memory = device.allocateMemory(allocInfo);
+        memoryFlags[memory] = deviceInfo.memoryProperties.memoryTypes[memoryType].propertyFlags;
         device.bindBufferMemory(buffer, memory, 0);
         return { buffer,memory };
     }
 
+    std::tuple<vk::Buffer, vk::DeviceMemory> createHostBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage)
+    {
+        return createBuffer(size, usage, vk::MemoryPropertyFlagBits::eHostCoherent | vk::MemoryPropertyFlagBits::eHostVisible);
+    }
+
+    std::tuple<vk::Buffer, vk::DeviceMemory> createDeviceBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage)
+    {
+        return createBuffer(size, usage | vk::BufferUsageFlagBits::eTransferDst | vk::BufferUsageFlagBits::eTransferSrc, vk::MemoryPropertyFlagBits::eDeviceLocal);
+    }
+
+    //buffer placed by the memory policy, fill and read it with uploadToBuffer and readbackFromBuffer
+    std::tuple<vk::Buffer, vk::DeviceMemory> createStorageBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage)
+    {
+        return useDeviceLocalMemory ? createDeviceBuffer(size, usage) : createHostBuffer(size, usage);
+    }
+
+    vk::CommandBuffer beginSingleTimeCommand()
+    {
+        vk::CommandBufferAllocateInfo allocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(allocInfo).front();
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        commandBuffer.begin(beginInfo);
+        return commandBuffer;
+    }
+
+    void endSingleTimeCommand(vk::CommandBuffer command)
+    {
+        command.end();
+        submitCompute(command, {});
+        queue.waitIdle();
+        releaseUploads();
+        releaseSemaphores();
+        device.freeCommandBuffers(commandPool, command);
+    }
+
+    //every submission to the compute queue goes through here, it waits for the uploads issued since the last one,
+    //callers streaming their own transfers add one semaphore to wait for and one to signal
+    void submitCompute(vk::CommandBuffer command, vk::Fence fence, vk::Semaphore waitSemaphore = {}, vk::Semaphore signalSemaphore = {})
+    {
+        std::vector<vk::Semaphore> waitSemaphores = uploadSemaphores;
+        if (waitSemaphore)
+        {
+            waitSemaphores.push_back(waitSemaphore);
+        }
+        std::vector<vk::PipelineStageFlags> waitStages(waitSemaphores.size(), vk::PipelineStageFlagBits::eAllCommands);
+        vk::SubmitInfo submitInfo(static_cast<uint32_t>(waitSemaphores.size()), waitSemaphores.data(), waitStages.data(), 1, &command,
+            signalSemaphore ? 1 : 0, &signalSemaphore);
+        queue.submit(submitInfo, fence);
+        waitedSemaphores.insert(waitedSemaphores.end(), uploadSemaphores.begin(), uploadSemaphores.end());
+        uploadSemaphores.clear();
+    }
+
+    //frees the staging memory of finished uploads, waitAll blocks until every upload is done
+    void releaseUploads(bool waitAll = false)
+    {
+        std::vector<PendingUpload> stillPending;
+        for (const auto& i : pendingUploads)
+        {
+            if (waitAll)
+            {
+                device.waitForFences(i.fence, VK_TRUE, UINT64_MAX);
+            }
+            else if (device.getFenceStatus(i.fence) != vk::Result::eSuccess)
+            {
+                stillPending.push_back(i);
+                continue;
+            }
+            device.destroyFence(i.fence);
+            device.freeCommandBuffers(transferCommandPool, i.command);
+            destroyBufferAndFreeMemory(i.stagingBuffer, i.stagingMemory);
+        }
+        pendingUploads = stillPending;
+    }
+
+    //only safe while the compute queue is idle, unwaited semaphores are kept for the next submission unless all is set
+    void releaseSemaphores(bool all = false)
+    {
+        for (auto i : waitedSemaphores)
+        {
+            device.destroySemaphore(i);
+        }
+        waitedSemaphores.clear();
+        if (all)
+        {
+            for (auto i : uploadSemaphores)
+            {
+                device.destroySemaphore(i);
+            }
+            uploadSemaphores.clear();
+        }
+    }
+
+    //resubmits a reusable batch until the GPU sets *doneFlag in host visible memory or batchCount batches ran,
+    //one batch stays queued behind the one being polled so the GPU does not idle,
+    //timed batches share their queries and run one at a time, residual is logged with their timestamps
+    void submitBatchesUntil(vk::CommandBuffer batchCommandBuffer, int batchCount, const volatile uint32_t* doneFlag, const volatile double* residual = nullptr)
+    {
+        std::array<vk::Fence, 2> batchFences{ device.createFence({}),device.createFence({}) };
+        int maxInFlight = timestampsEnabled() ? 1 : 2;
+        int submittedBatches = 0;
+        int finishedBatches = 0;
+        while (finishedBatches < batchCount)
+        {
+            while (submittedBatches < batchCount && submittedBatches - finishedBatches < maxInFlight)
+            {
+                submitCompute(batchCommandBuffer, batchFences[submittedBatches % 2]);
+                submittedBatches++;
+            }
+            device.waitForFences(batchFences[finishedBatches % 2], VK_TRUE, UINT64_MAX);
+            device.resetFences(batchFences[finishedBatches % 2]);
+            finishedBatches++;
+            if (timestampsEnabled())
+            {
+                collectTimestamps(residual ? *residual : std::numeric_limits<double>::quiet_NaN());
+            }
+            if (*doneFlag)
+            {
+                break;
+            }
+        }
+        queue.waitIdle();
+        releaseUploads();
+        releaseSemaphores();
+        for (auto i : batchFences)
+        {
+            device.destroyFence(i);
+        }
+    }
+
+    //opt-in gpu timing, call before the solver records its batch so the timestamps get recorded too,
+    //capacity bounds the timestamps of one batch and solvers shorten their batches to fit.
+    //only compute batches are timed, uploads and readbacks run on the transfer queue, which can't reset query pools
+    void enableTimestamps(uint32_t capacity = 1024)
+    {
+        const vk::QueueFamilyProperties& familyProperties = deviceInfo.queueFamilies[queueFamilyIndex];
+        if (familyProperties.timestampValidBits == 0)
+        {
+            throw std::runtime_error("queue family does not support timestamps");
+        }
+        if (timestampPool)
+        {
+            device.destroyQueryPool(timestampPool);
+        }
+        vk::QueryPoolCreateInfo queryPoolInfo({}, vk::QueryType::eTimestamp, capacity);
+        timestampPool = device.createQueryPool(queryPoolInfo);
+        timestampCapacity = capacity;
+        timestampPeriod = deviceInfo.properties.limits.timestampPeriod;
+        timestampMask = familyProperties.timestampValidBits >= 64 ? ~0ull : (1ull << familyProperties.timestampValidBits) - 1;
+        timestampRecords.clear();
+        timedBatches = 0;
+    }
+
+    inline bool timestampsEnabled()const { return timestampCapacity > 0; }
+
+    //how many groups of timestampsPerGroup timestamps, such as the rounds up to a convergence check, one batch can record.
+    //a pool too small for a single group is recreated with room for one, the records collected so far are kept
+    int timestampGroupsPerBatch(uint32_t timestampsPerGroup)
+    {
+        //query 0 is the start of the batch
+        if (timestampCapacity < timestampsPerGroup + 1)
+        {
+            device.destroyQueryPool(timestampPool);
+            timestampCapacity = timestampsPerGroup + 1;
+            vk::QueryPoolCreateInfo queryPoolInfo({}, vk::QueryType::eTimestamp, timestampCapacity);
+            timestampPool = device.createQueryPool(queryPoolInfo);
+        }
+        return static_cast<int>((timestampCapacity - 1) / timestampsPerGroup);
+    }
+
+    //starts the timestamps of a batch, every batch gets recorded with this first
+    void beginTimestamps(vk::CommandBuffer command)
+    {
+        if (!timestampsEnabled())
+        {
+            return;
+        }
+        timestampMarks.clear();
+        command.resetQueryPool(timestampPool, 0, timestampCapacity);
+        command.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, timestampPool, 0);
+    }
+
+    //ends the section of iteration started by the previous timestamp, label has to outlive the context,
+    //solvers write one after the dispatches of their compute batch, transfers are not timed
+    void writeTimestamp(vk::CommandBuffer command, int iteration, const char* label)
+    {
+        if (!timestampsEnabled())
+        {
+            return;
+        }
+        if (timestampMarks.size() + 1 >= timestampCapacity)
+        {
+            throw std::runtime_error("batch needs more timestamps than enableTimestamps allows");
+        }
+        timestampMarks.push_back({ iteration, label });
+        command.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, timestampPool, static_cast<uint32_t>(timestampMarks.size()));
+    }
+
+    //reads the timestamps of the batch that just finished
+    void collectTimestamps(double residual)
+    {
+        if (timestampMarks.empty())
+        {
+            return;
+        }
+        uint32_t queryCount = static_cast<uint32_t>(timestampMarks.size()) + 1;
+        std::vector<uint64_t> ticks(queryCount);
+        vk::Result result = device.getQueryPoolResults(timestampPool, 0, queryCount, queryCount * sizeof(uint64_t), ticks.data(), sizeof(uint64_t),
+            vk::QueryResultFlagBits::e64 | vk::QueryResultFlagBits::eWait);
+        if (result != vk::Result::eSuccess)
+        {
+            throw std::runtime_error("can't read timestamp queries");
+        }
+        int iterationsPerBatch = 0;
+        for (const auto& i : timestampMarks)
+        {
+            iterationsPerBatch = std::max(iterationsPerBatch, i.first + 1);
+        }
+        for (uint32_t k = 1; k < queryCount; k++)
+        {
+            const auto& mark = timestampMarks[k - 1];
+            uint64_t elapsed = ((ticks[k] & timestampMask) - (ticks[k - 1] & timestampMask)) & timestampMask;
+            bool lastIteration = mark.first + 1 == iterationsPerBatch;
+            timestampRecords.push_back({ timedBatches, static_cast<int>(timedBatches) * iterationsPerBatch + mark.first, mark.second,
+                elapsed * timestampPeriod * 1e-6, lastIteration ? residual : std::numeric_limits<double>::quiet_NaN() });
+        }
+        timedBatches++;
+    }
+
+    inline const std::vector<TimestampRecord>& getTimestampRecords()const { return timestampRecords; }
+
+    //one line per iteration with its gpu time, the sections it consists of and the residual when known
+    void printTimestampLog(std::ostream& out)const
+    {
+        size_t k = 0;
+        while (k < timestampRecords.size())
+        {
+            const TimestampRecord& first = timestampRecords[k];
+            double total = 0.0;
+            double residual = std::numeric_limits<double>::quiet_NaN();
+            std::string sections;
+            for (; k < timestampRecords.size() && timestampRecords[k].batch == first.batch && timestampRecords[k].iteration == first.iteration; k++)
+            {
+                total += timestampRecords[k].gpuMilliseconds;
+                residual = timestampRecords[k].residual;
+                sections += (sections.empty() ? "" : ", ") + std::string(timestampRecords[k].label) + " " + std::to_string(timestampRecords[k].gpuMilliseconds);
+            }
+            out << "batch " << first.batch << " iteration " << first.iteration << ": " << total << " ms (" << sections << ")";
+            if (!std::isnan(residual))
+            {
+                out << ", residual " << residual;
+            }
+            out << '\n';
+        }
+    }
+
+    vk::CommandBuffer beginTransferCommand()
+    {
+        vk::CommandBufferAllocateInfo allocInfo(transferCommandPool, vk::CommandBufferLevel::ePrimary, 1);
+        vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(allocInfo).front();
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
+        commandBuffer.begin(beginInfo);
+        return commandBuffer;
+    }
+
+    //blocks until the data is in the buffer
+    void uploadToBuffer(vk::Buffer buffer, vk::DeviceMemory memory, const void* data, vk::DeviceSize size, vk::DeviceSize offset = 0)
+    {
+        uploadToBufferAsync(buffer, memory, data, size, offset);
+        if (!pendingUploads.empty())
+        {
+            device.waitForFences(pendingUploads.back().fence, VK_TRUE, UINT64_MAX);
+            releaseUploads();
+        }
+    }
+
+    //stages the data and copies it on the transfer queue without waiting, so uploads overlap host work and running batches,
+    //the next compute submission waits for the copy, data can be reused as soon as this returns
+    void uploadToBufferAsync(vk::Buffer buffer, vk::DeviceMemory memory, const void* data, vk::DeviceSize size, vk::DeviceSize offset = 0)
+    {
+        if (isHostMappable(memory))
+        {
+            void* dataptr = device.mapMemory(memory, offset, size);
+            memcpy(dataptr, data, size);
+            device.unmapMemory(memory);
+            return;
+        }
+
+        PendingUpload upload;
+        std::tie(upload.stagingBuffer, upload.stagingMemory) = createHostBuffer(size, vk::BufferUsageFlagBits::eTransferSrc);
+        void* dataptr = device.mapMemory(upload.stagingMemory, 0, size);
+        memcpy(dataptr, data, size);
+        device.unmapMemory(upload.stagingMemory);
+
+        upload.command = beginTransferCommand();
+        vk::BufferCopy copyRegion(0, offset, size);
+        upload.command.copyBuffer(upload.stagingBuffer, buffer, copyRegion);
+        //make the upload visible to every later submission on the transfer queue, the semaphore covers the compute queue
+        vk::MemoryBarrier transferToAll(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eMemoryRead | vk::AccessFlagBits::eMemoryWrite);
+        upload.command.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eAllCommands, {}, transferToAll, {}, {});
+        upload.command.end();
+
+        vk::Semaphore uploaded = device.createSemaphore({});
+        upload.fence = device.createFence({});
+        vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &upload.command, 1, &uploaded);
+        transferQueue.submit(submitInfo, upload.fence);
+        uploadSemaphores.push_back(uploaded);
+        pendingUploads.push_back(upload);
+    }
+
+    void readbackFromBuffer(vk::Buffer buffer, vk::DeviceMemory memory, void* data, vk::DeviceSize size, vk::DeviceSize offset = 0)
+    {
+        if (isHostMappable(memory))
+        {
+            void* dataptr = device.mapMemory(memory, offset, size);
+            memcpy(data, dataptr, size);
+            device.unmapMemory(memory);
+            return;
+        }
+
+        vk::Buffer stagingBuffer;
+        vk::DeviceMemory stagingMemory;
+        std::tie(stagingBuffer, stagingMemory) = createHostBuffer(size, vk::BufferUsageFlagBits::eTransferDst);
+
+        //the compute queue is idle after every run, so the copy only has to follow earlier transfers
+        vk::CommandBuffer command = beginTransferCommand();
+        vk::MemoryBarrier allToTransfer(vk::AccessFlagBits::eMemoryWrite, vk::AccessFlagBits::eTransferRead);
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eAllCommands, vk::PipelineStageFlagBits::eTransfer, {}, allToTransfer, {}, {});
+        vk::BufferCopy copyRegion(offset, 0, size);
+        command.copyBuffer(buffer, stagingBuffer, copyRegion);
+        vk::MemoryBarrier transferToHost(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eHostRead);
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eHost, {}, transferToHost, {}, {});
+        command.end();
+        vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &command, 0, nullptr);
+        transferQueue.submit(submitInfo, {});
+        transferQueue.waitIdle();
+        device.freeCommandBuffers(transferCommandPool, command);
+
+        void* dataptr = device.mapMemory(stagingMemory, 0, size);
+        memcpy(data, dataptr, size);
+        device.unmapMemory(stagingMemory);
+        destroyBufferAndFreeMemory(stagingBuffer, stagingMemory);
+    }
+
+    //largest power of two the device allows that does not exceed the work, capped to keep occupancy reasonable,
+    //kernels keep one double of shared memory per invocation
+    uint32_t chooseWorkGroupSize(uint32_t workItems, uint32_t preferredMaxSize = 256)const
+    {
+        const vk::PhysicalDeviceLimits& limits = deviceInfo.properties.limits;
+        uint32_t maxSize = std::min(limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations);
+        maxSize = std::min(maxSize, static_cast<uint32_t>(limits.maxComputeSharedMemorySize / sizeof(double)));
+        maxSize = std::min(maxSize, preferredMaxSize);
+
+        uint32_t size = 1;
+        while (size * 2 <= maxSize && size < workItems)
+        {
+            size *= 2;
+        }
+        return size;
+    }
+
+    static std::vector<uint32_t> readSpirvFile(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+        {
+            throw std::runtime_error("can't open shader file " + path);
+        }
+        std::vector<char> fileStr{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+        file.close();
+        if (fileStr.size() % sizeof(uint32_t) != 0)
+        {
+            throw std::runtime_error("shader file " + path + " is not SPIR-V");
+        }
+        std::vector<uint32_t> code(fileStr.size() / sizeof(uint32_t));
+        memcpy(code.data(), fileStr.data(), fileStr.size());
+        return code;
+    }
+
+    //compute shaders take their workgroup size from specialization constant 0,
+    //extra 32 bit constants go to constant ids 1, 2, ...
+    vk::Pipeline createComputePipeline(const std::vector<uint32_t>& code, vk::PipelineLayout layout, uint32_t workGroupSize, const std::vector<uint32_t>& extraConstants = {})
+    {
+        vk::ShaderModuleCreateInfo shaderModuleCreateInfo({}, code.size() * sizeof(uint32_t), code.data());
+        vk::ShaderModule computeShaderModule = device.createShaderModule(shaderModuleCreateInfo);
+        std::vector<uint32_t> constants{ workGroupSize };
+        constants.insert(constants.end(), extraConstants.begin(), extraConstants.end());
+        std::vector<vk::SpecializationMapEntry> constantEntries;
+        for (uint32_t i = 0; i < constants.size(); i++)
+        {
+            constantEntries.push_back({ i, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t) });
+        }
+        vk::SpecializationInfo specializationInfo(static_cast<uint32_t>(constantEntries.size()), constantEntries.data(),
+            constants.size() * sizeof(uint32_t), constants.data());
+        vk::PipelineShaderStageCreateInfo computeStageInfo({}, vk::ShaderStageFlagBits::eCompute, computeShaderModule, "main", &specializationInfo);
+
+        vk::ComputePipelineCreateInfo pipelineCreateInfo({}, computeStageInfo, layout);
+        vk::Pipeline pipeline = device.createComputePipeline(pipelineCache.handle(), pipelineCreateInfo);
+        device.destroyShaderModule(computeShaderModule);
+        return pipeline;
+    }
+
+    vk::Pipeline loadComputePipeline(const std::string& path, vk::PipelineLayout layout, uint32_t workGroupSize, const std::vector<uint32_t>& extraConstants = {})
+    {
+        return createComputePipeline(readSpirvFile(path), layout, workGroupSize, extraConstants);
+    }
+
     void destroyBufferAndFreeMemory(vk::Buffer buffer, vk::DeviceMemory memory)
     {
+        memoryFlags.erase(memory);
         device.destroyBuffer(buffer);
         device.freeMemory(memory);
     }
 
+    //memory from createBuffer is mapped when its type is host visible and coherent, everything else goes through staging.
+    //device local memory can be host visible without being coherent, such as a resizable BAR heap, and mapping that
+    //would need flushes and invalidates
+    bool isHostMappable(vk::DeviceMemory memory)const
+    {
+        auto found = memoryFlags.find(memory);
+        if (found == memoryFlags.end())
+        {
+            throw std::runtime_error("memory was not allocated by createBuffer");
+        }
+        vk::MemoryPropertyFlags mappable = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+        return (found->second & mappable) == mappable;
+    }
+
     static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
         VkDebugUtilsMessageSeverityFlagBitsEXT           messageSeverity,
         VkDebugUtilsMessageTypeFlagsEXT                  messageTypes,
@@ -8,272 +8,561 @@
 #include<thread>
 #include<random>
 #include<sstream>
+#include<algorithm>
+#include<array>
+#include<string>
 #include<fmt/format.h>
 #include"SimpleComputeContext.h"
-
-class MyComputeProgram :protected SimpleComputeContext
+#include"ConvergenceCheck.h"
+#include"ComputeKernel.h"
+#include"SparseSolver.h"
+#include"CgSolver.h"
+#include"MixedPrecisionSolver.h"
+#include"BatchedSolver.h"
+#include"StreamingSolver.h"
+#include"CpuSolver.h"
+#include"MatrixLoader.h"
+#include"ElementwiseKernels.h"
+#include"Reduction.h"
+#include"DenseKernels.h"
+#include"MyComputeProgram.h"
+#include"TestProblems.h"
+
+//solves a 64 x 64 grid Poisson problem with a known solution
+void runSolverDemo(LinearSolver& solver, double diagonal = 5.0)
+{
+    arma::sp_mat A = createPoissonMatrix(64, diagonal);
+    arma::vec solutionX(A.n_rows, arma::fill::randu);
+    arma::vec b = A * solutionX;
+
+    solver.init(A, b);
+    arma::vec result = solver.run();
+    solver.destroy();
+    fmt::print("n = {}, nonzeros = {}, residual norm = {:e}, error norm = {:e}\n",
+        A.n_rows, A.n_nonzero, arma::norm(b - A * result), arma::norm(result - solutionX));
+}
+
+//dense diagonally dominant system like MyComputeProgram's random one, solved through the LinearSolver dense overload
+void runDenseSolverDemo(LinearSolver& solver, arma::uword n)
+{
+    arma::mat A(n, n, arma::fill::randu);
+    A.diag() += arma::sum(A, 1) + 3.0;
+    arma::vec solutionX(n, arma::fill::randu);
+    arma::vec b = A * solutionX;
+
+    solver.init(A, b);
+    arma::vec result = solver.run();
+    solver.destroy();
+    fmt::print("dense n = {}, residual norm = {:e}, error norm = {:e}\n", n, arma::norm(b - A * result), arma::norm(result - solutionX));
+}
+
+void runSparseDemo(SparseSolver::Method method, double omega = 1.0)
 {
-private:
-    arma::mat A;
-    arma::mat b;
-    arma::mat solutionX;
+    SparseSolver solver;
+    solver.setMethod(method);
+    solver.setRelaxation(omega);
+    runSolverDemo(solver);
+}
 
-    vk::Buffer matrixABuffer;
-    vk::DeviceMemory matrixBufferMemory;
+void runBatchedDemo(arma::uword systemCount)
+{
+    const arma::uword n = 10;
+    arma::cube A(n, n, systemCount, arma::fill::randu);
+    arma::mat solutionX(n, systemCount, arma::fill::randu);
+    arma::mat b(n, systemCount);
+    for (arma::uword s = 0; s < systemCount; s++)
+    {
+        //row sums on the diagonal keep every system diagonally dominant
+        A.slice(s).diag() += arma::sum(A.slice(s), 1) + 3.0;
+        b.col(s) = A.slice(s) * solutionX.col(s);
+    }
 
-    vk::Buffer vectorBBuffer;
-    vk::DeviceMemory vectorBBufferMemory;
+    BatchedSolver solver;
+    solver.init(A, b);
+    arma::mat result = solver.run();
+    solver.destroy();
+    fmt::print("{} systems of size {}, largest error {:e}\n", systemCount, n, arma::abs(result - solutionX).max());
+}
 
-    vk::Buffer assumeX0Buffer;
-    vk::DeviceMemory assumeX0BufferMemory;
+//checks axpy, fma and clamp against the cpu, then times back to back axpy dispatches
+void runElementwiseDemo(uint32_t n, int repeats)
+{
+    SimpleComputeContext context;
+    ElementwiseKernels kernels;
+    kernels.init(context);
+    arma::vec x(n, arma::fill::randu);
+    arma::vec y(n, arma::fill::randu);
+    arma::vec z(n, arma::fill::randu);
+    vk::DeviceSize size = n * sizeof(double);
+    std::array<vk::Buffer, 3> buffers;
+    std::array<vk::DeviceMemory, 3> bufferMemorys;
+    std::array<const arma::vec*, 3> hostVectors{ &x,&y,&z };
+    for (int i = 0; i < 3; i++)
+    {
+        std::tie(buffers[i], bufferMemorys[i]) = context.createStorageBuffer(size, vk::BufferUsageFlagBits::eStorageBuffer);
+        context.uploadToBuffer(buffers[i], bufferMemorys[i], hostVectors[i]->memptr(), size);
+    }
 
-    vk::Buffer calculatedXBuffer;
-    vk::DeviceMemory calculatedXBufferMemory;
+    vk::Device device = context.getDevice();
+    vk::CommandBufferAllocateInfo commandAllocInfo(context.getCommandPool(), vk::CommandBufferLevel::ePrimary, 2);
+    std::vector<vk::CommandBuffer> commands = device.allocateCommandBuffers(commandAllocInfo);
+    vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+    auto barrier = [&computeToCompute](vk::CommandBuffer command)
+    {
+        command.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+    };
+
+    //y = 2x + y, z += x * y, z = clamp(z, 0.5, 2)
+    commands[0].begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    kernels.recordAxpy(commands[0], 2.0, buffers[0], buffers[1], n);
+    barrier(commands[0]);
+    kernels.recordFma(commands[0], buffers[0], buffers[1], buffers[2], n);
+    barrier(commands[0]);
+    kernels.recordClamp(commands[0], 0.5, 2.0, buffers[2], buffers[2], n);
+    commands[0].end();
+
+    commands[1].begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    for (int i = 0; i < repeats; i++)
+    {
+        kernels.recordAxpy(commands[1], 1e-3, buffers[0], buffers[1], n);
+        barrier(commands[1]);
+    }
+    commands[1].end();
+
+    vk::Fence fence = device.createFence({});
+    context.submitCompute(commands[0], fence);
+    device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+    device.resetFences(fence);
+    context.releaseUploads();
+    context.releaseSemaphores();
+    arma::vec result(n);
+    context.readbackFromBuffer(buffers[2], bufferMemorys[2], result.memptr(), size);
+    arma::vec expected = arma::clamp(z + x % (2.0 * x + y), 0.5, 2.0);
+    fmt::print("axpy, fma and clamp over {} doubles, largest error {:e}\n", n, arma::abs(result - expected).max());
+
+    auto start = std::chrono::steady_clock::now();
+    context.submitCompute(commands[1], fence);
+    device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    //axpy reads x and y and writes y
+    fmt::print("{} axpy in {:.3f} ms, {:.1f} GB/s\n", repeats, seconds * 1e3, 3.0 * size * repeats / seconds * 1e-9);
+
+    device.destroyFence(fence);
+    device.freeCommandBuffers(context.getCommandPool(), commands);
+    for (int i = 0; i < 3; i++)
+    {
+        kernels.release(buffers[i]);
+        context.destroyBufferAndFreeMemory(buffers[i], bufferMemorys[i]);
+    }
+    kernels.destroy();
+}
 
-    vk::DescriptorSetLayout descriptorSetLayout;
-    vk::PipelineLayout pipelineLayout;
+//every reduction over a double and a float vector, compared with armadillo
+void runReductionDemo(uint32_t n)
+{
+    SimpleComputeContext context;
+    Reduction reduction;
+    reduction.init(context);
+    arma::vec x(n, arma::fill::randn);
+    arma::vec y(n, arma::fill::randn);
+    arma::fvec xFloat = arma::conv_to<arma::fvec>::from(x);
+
+    std::array<vk::Buffer, 3> buffers;
+    std::array<vk::DeviceMemory, 3> bufferMemorys;
+    std::array<const void*, 3> hostData{ x.memptr(),y.memptr(),xFloat.memptr() };
+    std::array<vk::DeviceSize, 3> sizes{ n * sizeof(double),n * sizeof(double),n * sizeof(float) };
+    for (int i = 0; i < 3; i++)
+    {
+        std::tie(buffers[i], bufferMemorys[i]) = context.createStorageBuffer(sizes[i], vk::BufferUsageFlagBits::eStorageBuffer);
+        context.uploadToBuffer(buffers[i], bufferMemorys[i], hostData[i], sizes[i]);
+    }
 
-    vk::Pipeline computePipeline;
+    struct Check
+    {
+        const char* name;
+        Reduction::Op op;
+        Reduction::ElementType type;
+        double expected;
+    };
+    std::vector<Check> checks{
+        { "sum", Reduction::Op::eSum, Reduction::ElementType::eDouble, arma::accu(x) },
+        { "dot", Reduction::Op::eDot, Reduction::ElementType::eDouble, arma::dot(x, y) },
+        { "norm", Reduction::Op::eNorm2, Reduction::ElementType::eDouble, arma::norm(x) },
+        { "max", Reduction::Op::eMax, Reduction::ElementType::eDouble, x.max() },
+        { "max abs", Reduction::Op::eMaxAbs, Reduction::ElementType::eDouble, arma::abs(x).max() },
+        { "argmax", Reduction::Op::eArgMax, Reduction::ElementType::eDouble, static_cast<double>(x.index_max()) },
+        { "argmax abs", Reduction::Op::eArgMaxAbs, Reduction::ElementType::eDouble, static_cast<double>(arma::abs(x).index_max()) },
+        { "float sum", Reduction::Op::eSum, Reduction::ElementType::eFloat, arma::accu(arma::conv_to<arma::vec>::from(xFloat)) },
+        { "float norm", Reduction::Op::eNorm2, Reduction::ElementType::eFloat, arma::norm(arma::conv_to<arma::vec>::from(xFloat)) } };
+
+    vk::Device device = context.getDevice();
+    vk::CommandBufferAllocateInfo commandAllocInfo(context.getCommandPool(), vk::CommandBufferLevel::ePrimary, 1);
+    vk::CommandBuffer command = device.allocateCommandBuffers(commandAllocInfo).front();
+    command.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+    for (uint32_t i = 0; i < checks.size(); i++)
+    {
+        bool isFloat = checks[i].type == Reduction::ElementType::eFloat;
+        reduction.record(command, checks[i].op, isFloat ? buffers[2] : buffers[0], buffers[1], n, i, checks[i].type);
+    }
+    command.end();
+    vk::Fence fence = device.createFence({});
+    context.submitCompute(command, fence);
+    device.waitForFences(fence, VK_TRUE, UINT64_MAX);
+    context.releaseUploads();
+    context.releaseSemaphores();
+
+    fmt::print("{} doubles, {}\n", n, reduction.usesSubgroups() ? "subgroup arithmetic" : "shared memory tree");
+    for (uint32_t i = 0; i < checks.size(); i++)
+    {
+        ReductionResult result = reduction.readResult(i);
+        bool isArg = checks[i].op == Reduction::Op::eArgMax || checks[i].op == Reduction::Op::eArgMaxAbs;
+        fmt::print("{:>10}: {:>22.15e} expected {:>22.15e}\n", checks[i].name, isArg ? result.index : result.value, checks[i].expected);
+    }
 
-    vk::DescriptorPool descriptorPool;
-    vk::DescriptorSet descriptorSet;
+    device.destroyFence(fence);
+    device.freeCommandBuffers(context.getCommandPool(), command);
+    for (int i = 0; i < 3; i++)
+    {
+        reduction.release(buffers[i]);
+        context.destroyBufferAndFreeMemory(buffers[i], bufferMemorys[i]);
+    }
+    reduction.destroy();
+}
 
-    std::vector<vk::CommandBuffer> commandBuffers;
+//GEMV and GEMM against armadillo in both precisions, sizes that are not multiples of the tiles on purpose
+//floatOnly lets the context pick a device without fp64 and skips the double kernels
+void runDenseDemo(arma::uword n, bool floatOnly)
+{
+    SimpleComputeContext::float64Required() = !floatOnly;
+    SimpleComputeContext context;
+    DenseKernels dense;
+    dense.init(context);
+    arma::mat A(n, n + 5, arma::fill::randu);
+    arma::mat B(n + 5, n / 2 + 3, arma::fill::randu);
+    arma::vec x(n + 5, arma::fill::randu);
+    arma::fmat floatA = arma::conv_to<arma::fmat>::from(A);
+    arma::fmat floatB = arma::conv_to<arma::fmat>::from(B);
+    arma::fvec floatX = arma::conv_to<arma::fvec>::from(x);
+
+    if (context.supportsFloat64())
+    {
+        auto start = std::chrono::steady_clock::now();
+        arma::mat product = dense.multiply(A, B);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fmt::print("gemm {} x {} x {}: largest error {:e}, {:.3f} ms with transfers\n", A.n_rows, B.n_cols, A.n_cols,
+            arma::abs(product - A * B).max(), seconds * 1e3);
+        fmt::print("gemv {} x {}: largest error {:e}\n", A.n_rows, A.n_cols, arma::abs(dense.multiply(A, x) - A * x).max());
+    }
+    fmt::print("float gemm: largest error {:e}\n", arma::abs(dense.multiply(floatA, floatB) - floatA * floatB).max());
+    fmt::print("float gemv: largest error {:e}\n", arma::abs(dense.multiply(floatA, floatX) - floatA * floatX).max());
+    dense.destroy();
+}
 
-    int calcRounds = 1;
-    std::vector<vk::Semaphore> computeFinishedSemaphores;
-    std::vector<vk::Semaphore> bufferCopyFinishedSemaphores;
-    //vk::Fence fence;
+//ranked physical devices and the one the compute context picked, TRYVULKAN_DEVICE=<index or name> picks another
+void listDevices()
+{
+    SimpleComputeContext context;
+    std::vector<DeviceInfo> devices = DeviceSelector::enumerate(context.instance, context.apiVersion);
+    DeviceSelector::print(std::cout, devices, SimpleComputeContext::deviceRequirements(), context.getPhysicalDevice());
+}
 
-    std::tuple<vk::Buffer, vk::DeviceMemory> sendMatrixToGPU(const arma::mat& matToSend, vk::BufferUsageFlags usage)
+//rounds of plain and Chebyshev accelerated Jacobi on the same symmetric system, both stop at the default tolerance
+void runChebyshevDemo(arma::uword size)
+{
+    arma::mat A = createSymmetricDenseMatrix(size);
+    arma::vec solutionX(size, arma::fill::randu);
+    arma::vec b = A * solutionX;
+    std::array<bool, 2> accelerated{ false, true };
+    for (bool chebyshev : accelerated)
     {
-        vk::DeviceSize matSize = matToSend.n_elem * sizeof(double);
-        auto result = createHostBuffer(matSize, usage);
-        void* dataptr = device.mapMemory(std::get<1>(result), 0, matSize);
-        const double* memptr = matToSend.memptr();
-        memcpy(dataptr, memptr, matSize);
-        device.unmapMemory(std::get<1>(result));
-        return result;
+        MyComputeProgram program;
+        program.setSystem(A, b);
+        program.setMatrixLayout(MyComputeProgram::MatrixLayout::eRowMajor);
+        program.setChebyshev(chebyshev);
+        program.init();
+        auto begin = std::chrono::steady_clock::now();
+        int rounds = program.run();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - begin;
+        double error = arma::norm(program.getResult() - solutionX);
+        program.destroy();
+        fmt::print("{:>9}: n = {}, {} rounds in {:.3f} s, error norm {:e}\n", chebyshev ? "chebyshev" : "jacobi", size, rounds, seconds.count(), error);
     }
-public:
-    MyComputeProgram()
+}
+
+//one solve of k right hand sides against k solves of one, the rounds are fixed so both do the same arithmetic
+void runMultiRhsBenchmark(arma::uword size, arma::uword rhsCount)
+{
+    const int rounds = 256;
+    std::array<arma::uword, 2> counts{ 1, rhsCount };
+    for (arma::uword count : counts)
     {
+        MyComputeProgram program;
+        program.setMatrixSize(size);
+        program.setMatrixLayout(MyComputeProgram::MatrixLayout::eRowMajor);
+        program.setRightHandSideCount(count);
+        program.setMaxRounds(rounds);
+        //never converges, so every round runs
+        program.setTolerance(-1.0);
+        program.init();
+        auto begin = std::chrono::steady_clock::now();
+        int ranRounds = program.run();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - begin;
+        program.destroy();
+        double perRhs = seconds.count() / ranRounds / count;
+        fmt::print("{:>3} right hand sides: n = {}, {} rounds in {:.3f} s, {:.3f} ms per round and right hand side\n",
+            count, size, ranRounds, seconds.count(), perRhs * 1e3);
     }
+}
 
-    ~MyComputeProgram()
+//dense system streamed through small slots, slotMegabytes forces several blocks even on small matrices
+void runStreamingDemo(arma::uword n, arma::uword slotMegabytes)
+{
+    arma::mat A(n, n, arma::fill::randu);
+    A.diag() += arma::sum(A, 1) + 3.0;
+    arma::vec solutionX(n, arma::fill::randu);
+    arma::vec b = A * solutionX;
+
+    StreamingSolver solver;
+    solver.setSlotBytes(slotMegabytes << 20);
+    solver.init(A, b);
+    arma::vec result = solver.run();
+    solver.destroy();
+    fmt::print("streamed {} x {} system, largest error {:e}\n", n, n, arma::abs(result - solutionX).max());
+}
+
+//solves a Matrix Market or binary problem file, dense binary files go through the dense Jacobi program,
+//sparse ones through the sparse Jacobi solver, b is 1 when the file has none
+void runFileDemo(const std::string& path)
+{
+    auto start = std::chrono::steady_clock::now();
+    auto secondsSinceStart = [&start] { return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(); };
+    bool matrixMarket = path.size() >= 4 && path.compare(path.size() - 4, 4, ".mtx") == 0;
+    CsrMatrix csr;
+    arma::vec b;
+    if (matrixMarket)
     {
+        ThreadPool pool;
+        csr = loadMatrixMarket(path, pool);
+        fmt::print("parsed {} nonzeros on {} threads in {:.3f} s\n", csr.nonZeros(), pool.size(), secondsSinceStart());
     }
-
-    void init()
+    else
     {
-        //init matrix data
-        std::default_random_engine dre(std::chrono::system_clock::now().time_since_epoch().count());
-        std::uniform_real_distribution<double> uid(0.1, 20.0);
-
-        A = arma::mat(10, 10);
-        solutionX = arma::mat(10, 1);
-        A.imbue([&dre, uid] {return uid(dre); });
-        for (int i = 0; i < A.n_rows; i++)
+        BinaryMatrixFile file;
+        file.open(path);
+        if (file.isDense())
         {
-            auto row = A.row(i);
-            double temp = 0.0;
-            for (auto k = row.begin(); k != row.end(); k++)
-            {
-                temp += *k;
-            }
-            row[i] = temp + 3.0;
+            file.close();
+            MyComputeProgram program;
+            program.setProblemFile(path);
+            program.init();
+            fmt::print("mapped and uploaded in {:.3f} s\n", secondsSinceStart());
+            program.run();
+            program.destroy();
+            return;
         }
-        solutionX.imbue([&dre, uid] {return uid(dre); });
-        b = A * solutionX;
-        arma::mat assumeX(b.n_elem, 1);
-        assumeX.imbue([&dre, uid] {return 10; });
-
-        //print equation
-        fmt::print("equation :\n");
-        for (size_t i = 0; i < b.n_elem; i++)
+        csr = file.toCsr();
+        if (file.rightHandSide() != nullptr)
         {
-            auto rowOfA = A.row(i);
-            fmt::print("{:>10.4f} * x0", rowOfA[0]);
-            for (size_t j = 1; j < rowOfA.n_elem; j++)
-            {
-                fmt::print(" + {:>10.4f} * x{}", rowOfA[j], j);
-            }
-            fmt::print(" = {:>10.4f}\n", b[i]);
+            b = arma::vec(file.rightHandSide(), csr.n_rows);
         }
-
-        //cpu calculation for debug
-
-        //for (int fun = 0; fun < 5 * b.n_elem; fun++)
-        //{
-        //    arma::mat _result(10, 1);
-        //    for (auto i = 0; i < b.n_elem; i++)
-        //    {
-        //        auto rowOfA = A.row(i);
-        //        double temp = 0.0;
-        //        for (int k = 0; k < rowOfA.n_elem; k++)
-        //        {
-        //            temp += rowOfA[k] * assumeX[k];
-        //        }
-        //        temp -= rowOfA[i] * assumeX[i];
-        //        temp = (b[i] - temp) / rowOfA[i];
-        //        fmt::print("{:.4f}\n", temp);
-        //        _result[i] = temp;
-        //    }
-        //    assumeX = _result;
-        //    std::cout << '\n';
-        //}
-
-        std::tie(matrixABuffer, matrixBufferMemory) = sendMatrixToGPU(A, vk::BufferUsageFlagBits::eStorageBuffer);
-        std::tie(vectorBBuffer, vectorBBufferMemory) = sendMatrixToGPU(b, vk::BufferUsageFlagBits::eStorageBuffer);
-        vk::DeviceSize sizeOfx = b.n_elem * sizeof(double);
-        std::tie(calculatedXBuffer, calculatedXBufferMemory) = createHostBuffer(sizeOfx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
-        std::tie(assumeX0Buffer, assumeX0BufferMemory) = sendMatrixToGPU(assumeX, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
-
-        std::vector<vk::DescriptorSetLayoutBinding> uniformBindings;
-        uniformBindings.push_back({ 0, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute });
-        uniformBindings.push_back({ 1, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute });
-        uniformBindings.push_back({ 2, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute });
-        uniformBindings.push_back({ 3, vk::DescriptorType::eStorageBuffer, 1, vk::ShaderStageFlagBits::eCompute });
-        vk::DescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo({}, 4, uniformBindings.data());
-        descriptorSetLayout = device.createDescriptorSetLayout(descriptorSetLayoutCreateInfo);
-        vk::PushConstantRange pushConstRange(vk::ShaderStageFlagBits::eCompute, 0, 4);
-        vk::PipelineLayoutCreateInfo pipelineLayoutCreateInfo({}, 1, &descriptorSetLayout, 1, &pushConstRange);
-        pipelineLayout = device.createPipelineLayout(pipelineLayoutCreateInfo);
-
-        //load compute shader stage
-        std::ifstream file("./shaders/jacobi.spv", std::ios::binary);
-        std::vector<char> fileStr{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
         file.close();
-        vk::ShaderModuleCreateInfo shaderModuleCreateInfo({}, fileStr.size(), reinterpret_cast<const uint32_t*>(fileStr.data()));
-        vk::ShaderModule computeShaderModule = device.createShaderModule(shaderModuleCreateInfo);
-        vk::PipelineShaderStageCreateInfo computeStageInfo({}, vk::ShaderStageFlagBits::eCompute, computeShaderModule, "main");
-
-        vk::ComputePipelineCreateInfo pipelineCreateInfo({}, computeStageInfo, pipelineLayout);
-        computePipeline = device.createComputePipeline({}, pipelineCreateInfo);
-        device.destroyShaderModule(computeShaderModule);
-
-        vk::DescriptorPoolSize descriptorPoolSize(vk::DescriptorType::eStorageBuffer, 4);
-        vk::DescriptorPoolCreateInfo descriptorPoolInfo({}, 1, 1, &descriptorPoolSize);
-        descriptorPool = device.createDescriptorPool(descriptorPoolInfo);
-        vk::DescriptorSetAllocateInfo descriptorSetAllocateInfo(descriptorPool, 1, &descriptorSetLayout);
-        descriptorSet = device.allocateDescriptorSets(descriptorSetAllocateInfo).front();
-
-        vk::DescriptorBufferInfo mataBindInfo{ matrixABuffer,0,VK_WHOLE_SIZE };
-        vk::DescriptorBufferInfo vecbBindInfo{ vectorBBuffer,0,VK_WHOLE_SIZE };
-        vk::DescriptorBufferInfo assumeXBindInfo{ assumeX0Buffer,0,VK_WHOLE_SIZE };
-        vk::DescriptorBufferInfo resultBufferBindInfo{ calculatedXBuffer,0,VK_WHOLE_SIZE };
-
-        std::vector<vk::WriteDescriptorSet> descriptorSetWrites;
-        descriptorSetWrites.push_back({ descriptorSet,0,0,1,vk::DescriptorType::eStorageBuffer,nullptr,&mataBindInfo });
-        descriptorSetWrites.push_back({ descriptorSet,1,0,1,vk::DescriptorType::eStorageBuffer,nullptr,&vecbBindInfo });
-        descriptorSetWrites.push_back({ descriptorSet,2,0,1,vk::DescriptorType::eStorageBuffer,nullptr,&assumeXBindInfo });
-        descriptorSetWrites.push_back({ descriptorSet,3,0,1,vk::DescriptorType::eStorageBuffer,nullptr,&resultBufferBindInfo });
-        device.updateDescriptorSets(descriptorSetWrites, {});
-
-        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 2);
-        commandBuffers = device.allocateCommandBuffers(commandAllocInfo);
-        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
-        commandBuffers[0].begin(beginInfo);
-        commandBuffers[0].bindPipeline(vk::PipelineBindPoint::eCompute, computePipeline);
-        commandBuffers[0].bindDescriptorSets(vk::PipelineBindPoint::eCompute, pipelineLayout, 0, descriptorSet, {});
-        int32_t pushConst = b.n_elem;
-        commandBuffers[0].pushConstants<uint32_t>(pipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, pushConst);
-        commandBuffers[0].dispatch(b.n_elem, 1, 1);
-        commandBuffers[0].end();
-
-        commandBuffers[1].begin(beginInfo);
-        vk::BufferCopy copyRange(0, 0, b.n_elem * sizeof(double));
-        commandBuffers[1].copyBuffer(calculatedXBuffer, assumeX0Buffer, copyRange);
-        commandBuffers[1].end();
-
-        calcRounds = 5 * b.n_elem;
-        computeFinishedSemaphores.resize(calcRounds);
-        bufferCopyFinishedSemaphores.resize(calcRounds);
-
-        for (int i = 0; i < calcRounds; i++)
-        {
-            computeFinishedSemaphores[i] = device.createSemaphore({});
-            bufferCopyFinishedSemaphores[i] = device.createSemaphore({});
-        }
+        fmt::print("mapped {} nonzeros in {:.3f} s\n", csr.nonZeros(), secondsSinceStart());
     }
-
-    void run()
+    if (b.is_empty())
     {
-        vk::SubmitInfo computeSubmitInfo(0, nullptr, nullptr, 1, &commandBuffers[0], 1, &computeFinishedSemaphores[0]);
-        vk::PipelineStageFlags bufferCopyStage = vk::PipelineStageFlagBits::eAllCommands;
-        vk::SubmitInfo bufferCopySubmitInfo(1, &computeFinishedSemaphores[0], &bufferCopyStage, 1, &commandBuffers[0], 1, &bufferCopyFinishedSemaphores[0]);
-        queue.submit(computeSubmitInfo, {});
-        queue.submit(bufferCopySubmitInfo, {});
+        b = arma::vec(csr.n_rows, arma::fill::ones);
+    }
 
-        for (int i = 1; i < calcRounds; i++)
-        {
-            vk::PipelineStageFlags computeSubmitStage = vk::PipelineStageFlagBits::eAllCommands;
-            vk::SubmitInfo computeSubmitInfo(1, &bufferCopyFinishedSemaphores[i - 1], &computeSubmitStage, 1, &commandBuffers[0], 1, &computeFinishedSemaphores[i]);
-            vk::PipelineStageFlags bufferCopyStage = vk::PipelineStageFlagBits::eAllCommands;
-            vk::SubmitInfo bufferCopySubmitInfo(1, &computeFinishedSemaphores[i], &bufferCopyStage, 1, &commandBuffers[1], 1, &bufferCopyFinishedSemaphores[i]);
-            queue.submit(computeSubmitInfo, {});
-            queue.submit(bufferCopySubmitInfo, {});
-        }
+    SparseSolver solver;
+    solver.init(csr, b);
+    arma::vec result = solver.run();
+    solver.destroy();
+    fmt::print("residual {:e}\n", arma::norm(csr.multiply(result) - b));
+}
 
-        queue.waitIdle();
-
-        //used to find bug
-
-        //void* ptr = device.mapMemory(calculatedXBufferMemory, 0, VK_WHOLE_SIZE);
-        //void* dstPtr = device.mapMemory(assumeX0BufferMemory, 0, VK_WHOLE_SIZE);
-        //for (int i = 0; i < calcRounds; i++)
-        //{
-        //    vk::SubmitInfo computeSubmit;
-        //    computeSubmit.commandBufferCount = 1;
-        //    computeSubmit.pCommandBuffers = &commandBuffers[0];
-        //    queue.submit(computeSubmit, fence);
-        //    queue.waitIdle();
-        //    device.waitForFences(fence, VK_TRUE, 0xFFFFFFFF);
-        //    device.resetFences(fence);
-        //    memcpy(dstPtr, ptr, b.n_elem * sizeof(double));
-        //}
-        //device.unmapMemory(calculatedXBufferMemory);
-        //device.unmapMemory(assumeX0BufferMemory);
-
-        void* dataptr = device.mapMemory(calculatedXBufferMemory, 0, VK_WHOLE_SIZE);
-        arma::mat resultMat(b.n_elem, 1);
-        memcpy(resultMat.memptr(), dataptr, b.n_elem * sizeof(double));
-        device.unmapMemory(calculatedXBufferMemory);
-        std::cout << "result :\n" << resultMat;
-        resultMat = arma::solve(A, b);
-        std::cout << "real result :\n" << resultMat;
-    }
-
-    void destroy()
-    {
-        //clean up
-        auto destroyBuffer = [this](auto buffer, auto memory)
-        {
-            device.destroyBuffer(buffer);
-            device.freeMemory(memory);
-        };
-
-        destroyBuffer(matrixABuffer, matrixBufferMemory);
-        destroyBuffer(vectorBBuffer, vectorBBufferMemory);
-        destroyBuffer(assumeX0Buffer, assumeX0BufferMemory);
-        destroyBuffer(calculatedXBuffer, calculatedXBufferMemory);
-        device.destroyDescriptorSetLayout(descriptorSetLayout);
-        device.destroyDescriptorPool(descriptorPool);
-        device.destroyPipeline(computePipeline);
-        device.destroyPipelineLayout(pipelineLayout);
-        for (auto i : computeFinishedSemaphores)
-        {
-            device.destroySemaphore(i);
-        }
-        for (auto i : bufferCopyFinishedSemaphores)
-        {
-            device.destroySemaphore(i);
-        }
+//Matrix Market to the binary format, so the next load is a plain mapping
+void convertMatrixFile(const std::string& inputPath, const std::string& outputPath)
+{
+    ThreadPool pool;
+    CsrMatrix csr = loadMatrixMarket(inputPath, pool);
+    saveBinaryMatrix(outputPath, csr);
+    fmt::print("{} x {} with {} nonzeros written to {}\n", csr.n_rows, csr.n_cols, csr.nonZeros(), outputPath);
+}
+
+//gpu time of every iteration of the sparse Jacobi and cg solvers, written to timestamps.log
+void runTimingDemo()
+{
+    std::ofstream log("timestamps.log");
+    SparseSolver jacobi;
+    jacobi.enableTimestamps();
+    runSolverDemo(jacobi);
+    log << "sparse jacobi\n";
+    jacobi.printTimestampLog(log);
+
+    CgSolver cg;
+    cg.enableTimestamps();
+    runSolverDemo(cg, 4.0);
+    log << "cg\n";
+    cg.printTimestampLog(log);
+
+    MixedPrecisionSolver mixed;
+    mixed.enableTimestamps();
+    runSolverDemo(mixed);
+    log << "mixed precision\n";
+    mixed.printTimestampLog(log);
+
+    MyComputeProgram dense;
+    dense.enableTimestamps();
+    dense.setMatrixSize(1024);
+    dense.init();
+    dense.run();
+    dense.destroy();
+    log << "dense jacobi\n";
+    dense.printTimestampLog(log);
+    fmt::print("{} jacobi, {} cg, {} mixed precision and {} dense jacobi timestamps written to timestamps.log\n", jacobi.getTimestampRecords().size(),
+        cg.getTimestampRecords().size(), mixed.getTimestampRecords().size(), dense.getTimestampRecords().size());
+}
+
+//every Jacobi round streams all of A once, so A's bytes per second is the bandwidth the kernel reaches
+void runLayoutBenchmark(arma::uword size)
+{
+    const int rounds = 256;
+    std::array<MyComputeProgram::MatrixLayout, 2> layouts{ MyComputeProgram::MatrixLayout::eColumnMajor, MyComputeProgram::MatrixLayout::eRowMajor };
+    std::array<const char*, 2> layoutNames{ "column major", "row major" };
+    for (size_t i = 0; i < layouts.size(); i++)
+    {
+        MyComputeProgram program;
+        program.setMatrixSize(size);
+        program.setMatrixLayout(layouts[i]);
+        program.setMaxRounds(rounds);
+        //never converges, so every round runs
+        program.setTolerance(-1.0);
+        program.init();
+        auto begin = std::chrono::steady_clock::now();
+        int ranRounds = program.run();
+        std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - begin;
+        program.destroy();
+        double bytes = static_cast<double>(ranRounds) * size * size * sizeof(double);
+        fmt::print("{:>12}: n = {}, {} rounds in {:.3f} s, {:.2f} GB/s\n", layoutNames[i], size, ranRounds, seconds.count(), bytes / seconds.count() / 1e9);
     }
-};
+}
 
-int main()
+int main(int argc, char** argv)
 {
+    std::string mode = argc > 1 ? argv[1] : "jacobi";
+    if (mode == "sparse-jacobi")
+    {
+        runSparseDemo(SparseSolver::Method::eJacobi);
+        return 0;
+    }
+    if (mode == "sparse-gauss-seidel")
+    {
+        runSparseDemo(SparseSolver::Method::eGaussSeidel);
+        return 0;
+    }
+    if (mode == "bench-layout")
+    {
+        runLayoutBenchmark(argc > 2 ? std::stoul(argv[2]) : 2048);
+        return 0;
+    }
+    if (mode == "batched")
+    {
+        runBatchedDemo(argc > 2 ? std::stoul(argv[2]) : 10000);
+        return 0;
+    }
+    if (mode == "mixed")
+    {
+        MixedPrecisionSolver solver;
+        runSolverDemo(solver);
+        return 0;
+    }
+    if (mode == "cg")
+    {
+        CgSolver solver;
+        runSolverDemo(solver, 4.0);
+        return 0;
+    }
+    if (mode == "cpu-jacobi")
+    {
+        CpuSolver solver(CpuSolver::Method::eJacobi);
+        runSolverDemo(solver);
+        return 0;
+    }
+    if (mode == "cpu-gauss-seidel")
+    {
+        CpuSolver solver(CpuSolver::Method::eGaussSeidel);
+        runSolverDemo(solver);
+        return 0;
+    }
+    if (mode == "cpu-dense")
+    {
+        CpuSolver solver(CpuSolver::Method::eJacobi);
+        runDenseSolverDemo(solver, argc > 2 ? std::stoul(argv[2]) : 2048);
+        return 0;
+    }
+    if (mode == "cpu-cg")
+    {
+        CpuSolver solver(CpuSolver::Method::eConjugateGradient);
+        runSolverDemo(solver, 4.0);
+        return 0;
+    }
+    if (mode == "streaming")
+    {
+        runStreamingDemo(argc > 2 ? std::stoul(argv[2]) : 4096, argc > 3 ? std::stoul(argv[3]) : 8);
+        return 0;
+    }
+    if (mode == "load" && argc > 2)
+    {
+        runFileDemo(argv[2]);
+        return 0;
+    }
+    if (mode == "convert" && argc > 3)
+    {
+        convertMatrixFile(argv[2], argv[3]);
+        return 0;
+    }
+    if (mode == "elementwise")
+    {
+        runElementwiseDemo(argc > 2 ? std::stoul(argv[2]) : (1u << 24) + 3, 100);
+        return 0;
+    }
+    if (mode == "reduce")
+    {
+        runReductionDemo(argc > 2 ? std::stoul(argv[2]) : 1000003);
+        return 0;
+    }
+    if (mode == "dense" || mode == "dense-float")
+    {
+        runDenseDemo(argc > 2 ? std::stoul(argv[2]) : 1000, mode == "dense-float");
+        return 0;
+    }
+    if (mode == "multi-rhs")
+    {
+        runMultiRhsBenchmark(argc > 2 ? std::stoul(argv[2]) : 2048, argc > 3 ? std::stoul(argv[3]) : 32);
+        return 0;
+    }
+    if (mode == "devices")
+    {
+        listDevices();
+        return 0;
+    }
+    if (mode == "chebyshev")
+    {
+        runChebyshevDemo(argc > 2 ? std::stoul(argv[2]) : 2048);
+        return 0;
+    }
+    if (mode == "timing")
+    {
+        runTimingDemo();
+        return 0;
+    }
+    if (mode == "sparse-sor")
+    {
+        double omega = argc > 2 ? std::stod(argv[2]) : 1.0;
+        runSparseDemo(SparseSolver::Method::eMulticolorGaussSeidel, omega);
+        return 0;
+    }
+
     MyComputeProgram program;
     program.init();
     program.run();
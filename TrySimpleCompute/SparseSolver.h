@@ -0,0 +1,346 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<array>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"ConvergenceCheck.h"
+#include"ComputeKernel.h"
+#include"CsrMatrix.h"
+#include"LinearSolver.h"
+
+//Jacobi, hybrid Gauss-Seidel and multicolor SOR on a CSR copy of the matrix, every row needs a stored diagonal
+class SparseSolver :public LinearSolver, protected SimpleComputeContext
+{
+public:
+    enum class Method
+    {
+        eJacobi,
+        eGaussSeidel,
+        eMulticolorGaussSeidel
+    };
+
+    struct PushConstants
+    {
+        int32_t nRows;
+        int32_t rowsPerInvocation;
+    };
+
+    struct MulticolorPushConstants
+    {
+        int32_t colorBegin;
+        int32_t colorRows;
+        double omega;
+    };
+private:
+    CsrMatrix A;
+    Method method = Method::eJacobi;
+
+    vk::Buffer rowPtrBuffer;
+    vk::DeviceMemory rowPtrBufferMemory;
+    vk::Buffer colIdxBuffer;
+    vk::DeviceMemory colIdxBufferMemory;
+    vk::Buffer valuesBuffer;
+    vk::DeviceMemory valuesBufferMemory;
+
+    vk::Buffer vectorBBuffer;
+    vk::DeviceMemory vectorBBufferMemory;
+
+    //round i reads iterateBuffers[i % 2] and writes the other one,
+    //multicolor sweeps update iterateBuffers[0] in place and snapshot it into iterateBuffers[1] before a convergence check
+    std::array<vk::Buffer, 2> iterateBuffers;
+    std::array<vk::DeviceMemory, 2> iterateBufferMemorys;
+
+    ComputeKernel kernel;
+    vk::Pipeline computePipeline;
+    //buffers of round i % 2, multicolor sweeps only use the first
+    std::array<std::vector<KernelArg>, 2> roundArgs;
+
+    //rows sorted by color, color c owns colorRows[colorRowOffsets[c], colorRowOffsets[c + 1])
+    std::vector<uint32_t> colorRowOffsets;
+    vk::Buffer colorRowsBuffer;
+    vk::DeviceMemory colorRowsBufferMemory;
+
+    ConvergenceCheck convergenceCheck;
+    vk::CommandBuffer batchCommandBuffer;
+
+    uint32_t workGroupSize = 1;
+    int maxRounds = 0;
+    int roundsPerBatch = 0;
+    int batchCount = 1;
+    int checkInterval = 16;
+    int rowsPerInvocation = 4;
+    double tolerance = 1e-10;
+    double omega = 1.0;
+
+    std::tuple<vk::Buffer, vk::DeviceMemory> sendToGPU(const void* data, vk::DeviceSize size, vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer)
+    {
+        auto result = createStorageBuffer(size, usage);
+        uploadToBufferAsync(std::get<0>(result), std::get<1>(result), data, size);
+        return result;
+    }
+
+    void createColorRows(const arma::sp_mat& matA)
+    {
+        std::vector<uint32_t> colors = greedyColoring(matA);
+        uint32_t colorCount = colors.empty() ? 0 : *std::max_element(colors.begin(), colors.end()) + 1;
+        colorRowOffsets.assign(colorCount + 1, 0);
+        for (auto c : colors)
+        {
+            colorRowOffsets[c + 1]++;
+        }
+        for (uint32_t c = 0; c < colorCount; c++)
+        {
+            colorRowOffsets[c + 1] += colorRowOffsets[c];
+        }
+        std::vector<uint32_t> colorRows(colors.size());
+        std::vector<uint32_t> fill(colorRowOffsets.begin(), colorRowOffsets.end() - 1);
+        for (uint32_t row = 0; row < colors.size(); row++)
+        {
+            colorRows[fill[colors[row]]++] = row;
+        }
+        std::tie(colorRowsBuffer, colorRowsBufferMemory) = sendToGPU(colorRows.data(), colorRows.size() * sizeof(uint32_t));
+    }
+
+    void recordPingPongRounds()
+    {
+        PushConstants pushConst{ static_cast<int32_t>(A.n_rows), rowsPerInvocation };
+        const char* roundLabel = method == Method::eJacobi ? "jacobi" : "gauss-seidel";
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        for (int i = 0; i < roundsPerBatch; i++)
+        {
+            kernel.recordIndirect(batchCommandBuffer, computePipeline, roundArgs[i % 2], pushConst, convergenceCheck.getStatusBuffer());
+            batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+            writeTimestamp(batchCommandBuffer, i, roundLabel);
+
+            if ((i + 1) % checkInterval == 0)
+            {
+                convergenceCheck.record(batchCommandBuffer);
+                writeTimestamp(batchCommandBuffer, i, "check");
+            }
+        }
+    }
+
+    //one sweep relaxes the colors in order, the kernel itself skips the work once the check has converged
+    void recordMulticolorSweeps()
+    {
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        vk::MemoryBarrier computeToTransfer(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eTransferRead);
+        vk::MemoryBarrier transferToCompute(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead);
+        vk::BufferCopy snapshotRange(0, 0, A.n_rows * sizeof(double));
+        for (int i = 0; i < roundsPerBatch; i++)
+        {
+            bool lastSweepBeforeCheck = (i + 1) % checkInterval == 0;
+            if (lastSweepBeforeCheck)
+            {
+                batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eTransfer, {}, computeToTransfer, {}, {});
+                batchCommandBuffer.copyBuffer(iterateBuffers[0], iterateBuffers[1], snapshotRange);
+                batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, transferToCompute, {}, {});
+                writeTimestamp(batchCommandBuffer, i, "snapshot");
+            }
+            for (uint32_t c = 0; c + 1 < colorRowOffsets.size(); c++)
+            {
+                uint32_t colorRows = colorRowOffsets[c + 1] - colorRowOffsets[c];
+                MulticolorPushConstants pushConst{ static_cast<int32_t>(colorRowOffsets[c]), static_cast<int32_t>(colorRows), omega };
+                kernel.record(batchCommandBuffer, computePipeline, roundArgs[0], pushConst, (colorRows + workGroupSize - 1) / workGroupSize);
+                batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+            }
+            writeTimestamp(batchCommandBuffer, i, "sweep");
+            if (lastSweepBeforeCheck)
+            {
+                convergenceCheck.record(batchCommandBuffer);
+                writeTimestamp(batchCommandBuffer, i, "check");
+            }
+        }
+    }
+public:
+    using SimpleComputeContext::MemoryPolicy;
+    using SimpleComputeContext::setMemoryPolicy;
+    using SimpleComputeContext::enableTimestamps;
+    using SimpleComputeContext::getTimestampRecords;
+    using SimpleComputeContext::printTimestampLog;
+
+    //number of rounds recorded into one command buffer, 0 records every round into a single submission
+    void setRoundsPerBatch(int rounds)
+    {
+        roundsPerBatch = rounds;
+    }
+
+    //largest change of any unknown between two iterates that counts as converged
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    //convergence is tested every interval rounds, rounded up to an even number
+    void setCheckInterval(int interval)
+    {
+        checkInterval = std::max(2, interval + interval % 2);
+    }
+
+    //upper bound on the number of rounds, 0 uses 5 * n like the dense solver
+    void setMaxRounds(int rounds)
+    {
+        maxRounds = rounds;
+    }
+
+    //rows every Gauss-Seidel invocation sweeps in order, larger blocks converge faster but run less parallel
+    void setRowsPerInvocation(int rows)
+    {
+        rowsPerInvocation = std::max(1, rows);
+    }
+
+    void setMethod(Method solveMethod)
+    {
+        method = solveMethod;
+    }
+
+    //relaxation factor of the multicolor sweep, 1 is plain Gauss-Seidel, between 1 and 2 over-relaxes
+    void setRelaxation(double value)
+    {
+        omega = value;
+    }
+
+    using LinearSolver::init;
+
+    void init(const arma::sp_mat& matA, const arma::vec& b) override
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != b.n_elem)
+        {
+            throw std::runtime_error("sparse solver needs a square matrix matching b");
+        }
+        init(CsrMatrix::fromArma(matA), b);
+    }
+
+    //for matrices that are loaded as csr already, such as problem files, the upload reads matA as is
+    void init(const CsrMatrix& matA, const arma::vec& b)
+    {
+        if (matA.n_rows != matA.n_cols || matA.n_rows != b.n_elem)
+        {
+            throw std::runtime_error("sparse solver needs a square matrix matching b");
+        }
+        matA.requireNonzeroDiagonal();
+        A = matA;
+        if (method != Method::eGaussSeidel)
+        {
+            rowsPerInvocation = 1;
+        }
+        bool multicolor = method == Method::eMulticolorGaussSeidel;
+
+        arma::vec assumeX(b.n_elem, arma::fill::zeros);
+        vk::DeviceSize sizeOfx = b.n_elem * sizeof(double);
+        std::tie(rowPtrBuffer, rowPtrBufferMemory) = sendToGPU(A.rowPtr.data(), A.rowPtr.size() * sizeof(uint32_t));
+        std::tie(colIdxBuffer, colIdxBufferMemory) = sendToGPU(A.colIdx.data(), A.colIdx.size() * sizeof(uint32_t));
+        std::tie(valuesBuffer, valuesBufferMemory) = sendToGPU(A.values.data(), A.values.size() * sizeof(double));
+        std::tie(vectorBBuffer, vectorBBufferMemory) = sendToGPU(b.memptr(), sizeOfx);
+        std::tie(iterateBuffers[0], iterateBufferMemorys[0]) = sendToGPU(assumeX.memptr(), sizeOfx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferSrc);
+        std::tie(iterateBuffers[1], iterateBufferMemorys[1]) = createStorageBuffer(sizeOfx, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eTransferDst);
+        if (multicolor)
+        {
+            //the coloring symmetrizes the pattern, armadillo does the transpose for it
+            createColorRows(A.toArma());
+        }
+
+        uint32_t invocations = (A.n_rows + rowsPerInvocation - 1) / rowsPerInvocation;
+        workGroupSize = chooseWorkGroupSize(invocations);
+        uint32_t groupCount = (invocations + workGroupSize - 1) / workGroupSize;
+        const char* shaderPath = "./shaders/sparseJacobi.spv";
+        if (method == Method::eGaussSeidel)
+        {
+            shaderPath = "./shaders/sparseGaussSeidel.spv";
+        }
+        else if (multicolor)
+        {
+            shaderPath = "./shaders/multicolorSor.spv";
+        }
+        kernel.init(*this, shaderPath);
+        computePipeline = kernel.pipeline(workGroupSize);
+        convergenceCheck.init(*this, iterateBuffers[0], iterateBuffers[1], A.n_rows, workGroupSize, { groupCount, 1, 1 }, tolerance);
+
+        for (int i = 0; i < 2; i++)
+        {
+            roundArgs[i] = { kernelArg<uint32_t>(rowPtrBuffer), kernelArg<uint32_t>(colIdxBuffer), kernelArg<double>(valuesBuffer),
+                kernelArg<double>(vectorBBuffer), kernelArg<double>(iterateBuffers[i]) };
+            if (multicolor)
+            {
+                roundArgs[i].push_back(kernelArg<uint32_t>(colorRowsBuffer));
+                roundArgs[i].push_back(kernelArg<SolverStatus>(convergenceCheck.getStatusBuffer()));
+            }
+            else
+            {
+                roundArgs[i].push_back(kernelArg<double>(iterateBuffers[1 - i]));
+            }
+        }
+
+        int calcRounds = maxRounds > 0 ? maxRounds : 5 * static_cast<int>(A.n_rows);
+        if (roundsPerBatch <= 0 || roundsPerBatch > calcRounds)
+        {
+            roundsPerBatch = calcRounds;
+        }
+        if (timestampsEnabled())
+        {
+            //a round writes one timestamp and every check one more, multicolor sweeps also time the snapshot before it
+            uint32_t timestampsPerCheck = static_cast<uint32_t>(checkInterval) + (multicolor ? 2 : 1);
+            roundsPerBatch = std::min(roundsPerBatch, timestampGroupsPerBatch(timestampsPerCheck) * checkInterval);
+        }
+        //a batch ends on a convergence check after an even number of rounds, so it can be resubmitted as is
+        roundsPerBatch = (roundsPerBatch + checkInterval - 1) / checkInterval * checkInterval;
+        batchCount = (calcRounds + roundsPerBatch - 1) / roundsPerBatch;
+
+        vk::CommandBufferAllocateInfo commandAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
+        batchCommandBuffer = device.allocateCommandBuffers(commandAllocInfo).front();
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+        batchCommandBuffer.begin(beginInfo);
+        beginTimestamps(batchCommandBuffer);
+        if (multicolor)
+        {
+            recordMulticolorSweeps();
+        }
+        else
+        {
+            recordPingPongRounds();
+        }
+        vk::MemoryBarrier computeToHost(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        batchCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, computeToHost, {}, {});
+        batchCommandBuffer.end();
+    }
+
+    arma::vec run() override
+    {
+        SolverStatus status = convergenceCheck.runBatches(batchCommandBuffer, batchCount);
+        const char* methodName = "sparse jacobi";
+        if (method == Method::eGaussSeidel)
+        {
+            methodName = "sparse gauss-seidel";
+        }
+        else if (method == Method::eMulticolorGaussSeidel)
+        {
+            methodName = "multicolor sor";
+        }
+        report.iterations = status.checkCount * checkInterval;
+        report.converged = status.converged != 0;
+        fmt::print("{} {} after {} rounds, max update {:e}\n", methodName,
+            status.converged ? "converged" : "did not converge", status.checkCount * checkInterval, status.updateNorm);
+
+        arma::vec result(A.n_rows);
+        readbackFromBuffer(iterateBuffers[0], iterateBufferMemorys[0], result.memptr(), A.n_rows * sizeof(double));
+        return result;
+    }
+
+    void destroy() override
+    {
+        destroyBufferAndFreeMemory(rowPtrBuffer, rowPtrBufferMemory);
+        destroyBufferAndFreeMemory(colIdxBuffer, colIdxBufferMemory);
+        destroyBufferAndFreeMemory(valuesBuffer, valuesBufferMemory);
+        destroyBufferAndFreeMemory(vectorBBuffer, vectorBBufferMemory);
+        destroyBufferAndFreeMemory(iterateBuffers[0], iterateBufferMemorys[0]);
+        destroyBufferAndFreeMemory(iterateBuffers[1], iterateBufferMemorys[1]);
+        if (colorRowsBuffer)
+        {
+            destroyBufferAndFreeMemory(colorRowsBuffer, colorRowsBufferMemory);
+        }
+        kernel.destroy();
+        convergenceCheck.destroy();
+        device.freeCommandBuffers(commandPool, batchCommandBuffer);
+    }
+};
@@ -0,0 +1,297 @@
+#pragma once
+#include<vulkan/vulkan.hpp>
+#include<armadillo>
+#include<array>
+#include<limits>
+#include<fmt/format.h>
+#include"SimpleComputeContext.h"
+#include"ComputeKernel.h"
+#include"ConvergenceCheck.h"
+#include"LinearSolver.h"
+
+//dense Jacobi for matrices larger than device memory, row blocks of A cycle through two device slots,
+//the next block is copied on the transfer queue while the current one is computed, b and the iterates stay resident.
+//when A fits in the slots every block keeps its own slot and is copied only once
+class StreamingSolver :protected SimpleComputeContext
+{
+public:
+    //matches jacobi.comp, which does not read rhsCount
+    struct PushConstants
+    {
+        int32_t nCols;
+        int32_t rhsCount;
+        int32_t rowOffset;
+    };
+private:
+    static constexpr uint32_t slotCount = 2;
+
+    //column j is row j of A, so every row block is one contiguous range
+    arma::mat transposedA;
+    //row major A, either transposedA or memory owned by the caller such as a mapped problem file
+    const double* rowMajorA = nullptr;
+    uint32_t n = 0;
+    uint32_t blockRows = 1;
+    uint32_t blockCount = 0;
+    //blockCount <= slotCount, the blocks stay on the device after the first round
+    bool resident = false;
+
+    std::array<vk::Buffer, slotCount> blockBuffers;
+    std::array<vk::DeviceMemory, slotCount> blockBufferMemorys;
+    //host visible copies of the slots, mapped for the whole solve
+    std::array<vk::Buffer, slotCount> stagingBuffers;
+    std::array<vk::DeviceMemory, slotCount> stagingBufferMemorys;
+    std::array<void*, slotCount> stagingPtrs;
+
+    vk::Buffer vectorBBuffer;
+    vk::DeviceMemory vectorBBufferMemory;
+    //round i reads iterateBuffers[i % 2] and writes the other one
+    std::array<vk::Buffer, 2> iterateBuffers;
+    std::array<vk::DeviceMemory, 2> iterateBufferMemorys;
+
+    //a slot is filled by the transfer queue, then consumed by the compute queue, then filled again
+    std::array<vk::Semaphore, slotCount> filledSemaphores;
+    std::array<vk::Semaphore, slotCount> consumedSemaphores;
+    //signals when the staging buffer of the slot can be overwritten
+    std::array<vk::Fence, slotCount> transferFences;
+    std::array<bool, slotCount> slotUsed{};
+
+    //block j always goes through slot j % slotCount
+    std::vector<vk::CommandBuffer> transferCommandBuffers;
+    //index block * 2 + round % 2
+    std::vector<vk::CommandBuffer> blockCommandBuffers;
+    vk::CommandBuffer checkCommandBuffer;
+    vk::Fence checkFence;
+
+    ComputeKernel jacobiKernel;
+    ConvergenceCheck convergenceCheck;
+    SolveReport report;
+
+    uint32_t workGroupSize = 1;
+    vk::DeviceSize slotBytes = 64ull << 20;
+    int maxRounds = 0;
+    int checkInterval = 16;
+    double tolerance = 1e-10;
+
+    inline uint32_t rowsOfBlock(uint32_t block)const { return std::min(blockRows, n - block * blockRows); }
+
+    void recordCommandBuffers()
+    {
+        vk::CommandBufferAllocateInfo transferAllocInfo(transferCommandPool, vk::CommandBufferLevel::ePrimary, blockCount);
+        transferCommandBuffers = device.allocateCommandBuffers(transferAllocInfo);
+        vk::CommandBufferAllocateInfo computeAllocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 2 * blockCount + 1);
+        blockCommandBuffers = device.allocateCommandBuffers(computeAllocInfo);
+        checkCommandBuffer = blockCommandBuffers.back();
+        blockCommandBuffers.pop_back();
+
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eSimultaneousUse);
+        vk::MemoryBarrier computeToCompute(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eShaderRead);
+        //the blocks are row major
+        vk::Pipeline jacobiPipeline = jacobiKernel.pipeline(workGroupSize, { VK_TRUE });
+        for (uint32_t block = 0; block < blockCount; block++)
+        {
+            uint32_t slot = block % slotCount;
+            vk::CommandBuffer transfer = transferCommandBuffers[block];
+            transfer.begin(beginInfo);
+            vk::BufferCopy blockRange(0, 0, static_cast<vk::DeviceSize>(rowsOfBlock(block)) * n * sizeof(double));
+            transfer.copyBuffer(stagingBuffers[slot], blockBuffers[slot], blockRange);
+            transfer.end();
+
+            for (uint32_t parity = 0; parity < 2; parity++)
+            {
+                vk::CommandBuffer compute = blockCommandBuffers[block * 2 + parity];
+                compute.begin(beginInfo);
+                //the previous round has to be finished with the iterate this block reads
+                compute.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+                PushConstants pushConst{ static_cast<int32_t>(n), 1, static_cast<int32_t>(block * blockRows) };
+                jacobiKernel.record(compute, jacobiPipeline,
+                    { kernelArg<double>(blockBuffers[slot]), kernelArg<double>(vectorBBuffer), kernelArg<double>(iterateBuffers[parity]), kernelArg<double>(iterateBuffers[1 - parity]) },
+                    pushConst, rowsOfBlock(block));
+                compute.end();
+            }
+        }
+
+        checkCommandBuffer.begin(beginInfo);
+        checkCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eComputeShader, {}, computeToCompute, {}, {});
+        convergenceCheck.record(checkCommandBuffer);
+        vk::MemoryBarrier computeToHost(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead);
+        checkCommandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eHost, {}, computeToHost, {}, {});
+        checkCommandBuffer.end();
+    }
+
+    //waits until the slot's staging buffer is free, fills it and queues the copy and the Jacobi pass of the block,
+    //a resident block that is already on the device only queues the pass
+    void streamBlock(uint32_t block, uint32_t parity)
+    {
+        uint32_t slot = block % slotCount;
+        vk::CommandBuffer compute = blockCommandBuffers[block * 2 + parity];
+        if (resident && slotUsed[slot])
+        {
+            submitCompute(compute, {});
+            return;
+        }
+        if (slotUsed[slot])
+        {
+            device.waitForFences(transferFences[slot], VK_TRUE, UINT64_MAX);
+            device.resetFences(transferFences[slot]);
+        }
+        memcpy(stagingPtrs[slot], rowMajorA + static_cast<size_t>(block) * blockRows * n, static_cast<size_t>(rowsOfBlock(block)) * n * sizeof(double));
+
+        //the copy must not overwrite the slot before the previous block in it was consumed
+        vk::PipelineStageFlags transferWaitStage = vk::PipelineStageFlagBits::eTransfer;
+        vk::SubmitInfo transferSubmitInfo(slotUsed[slot] ? 1 : 0, &consumedSemaphores[slot], &transferWaitStage,
+            1, &transferCommandBuffers[block], 1, &filledSemaphores[slot]);
+        transferQueue.submit(transferSubmitInfo, transferFences[slot]);
+        //nothing refills a resident slot, so nothing would wait for the consumed semaphore
+        submitCompute(compute, {}, filledSemaphores[slot], resident ? vk::Semaphore() : consumedSemaphores[slot]);
+        slotUsed[slot] = true;
+    }
+public:
+    using SimpleComputeContext::MemoryPolicy;
+    using SimpleComputeContext::setMemoryPolicy;
+
+    //device memory of one of the two block slots, a block holds as many whole rows as fit
+    void setSlotBytes(vk::DeviceSize bytes)
+    {
+        slotBytes = bytes;
+    }
+
+    //largest change of any unknown between two iterates that counts as converged
+    void setTolerance(double value)
+    {
+        tolerance = value;
+    }
+
+    //convergence is tested every interval rounds, rounded up to an even number
+    void setCheckInterval(int interval)
+    {
+        checkInterval = std::max(2, interval + interval % 2);
+    }
+
+    //upper bound on the number of rounds, 0 uses 5 * n like the dense solver
+    void setMaxRounds(int rounds)
+    {
+        maxRounds = rounds;
+    }
+
+    //A only has to fit in host memory, the host keeps a transposed copy of it for the whole solve
+    void init(const arma::mat& matA, const arma::vec& b)
+    {
+        if (matA.n_rows != matA.n_cols)
+        {
+            throw std::runtime_error("streaming solver needs a square matrix");
+        }
+        transposedA = matA.t();
+        init(transposedA.memptr(), matA.n_rows, b);
+    }
+
+    //rowMajorA holds nRows x nRows doubles and has to stay valid until run returns
+    void init(const double* rowMajorA, arma::uword nRows, const arma::vec& b)
+    {
+        if (nRows != b.n_elem)
+        {
+            throw std::runtime_error("streaming solver needs a square matrix matching b");
+        }
+        if (nRows > std::numeric_limits<int32_t>::max())
+        {
+            throw std::runtime_error("matrix too large for 32 bit indices");
+        }
+        n = static_cast<uint32_t>(nRows);
+        this->rowMajorA = rowMajorA;
+
+        //whole rows per slot, bounded by the workgroup count of one dispatch and by 32 bit indices into the slot
+        uint32_t maxGroupCount = deviceInfo.properties.limits.maxComputeWorkGroupCount[0];
+        vk::DeviceSize rowBytes = static_cast<vk::DeviceSize>(n) * sizeof(double);
+        vk::DeviceSize rows = std::max<vk::DeviceSize>(1, slotBytes / rowBytes);
+        rows = std::min<vk::DeviceSize>(rows, std::min<vk::DeviceSize>(n, maxGroupCount));
+        rows = std::min<vk::DeviceSize>(rows, std::numeric_limits<uint32_t>::max() / n);
+        blockRows = static_cast<uint32_t>(rows);
+        blockCount = (n + blockRows - 1) / blockRows;
+        resident = blockCount <= slotCount;
+
+        vk::DeviceSize blockSize = static_cast<vk::DeviceSize>(blockRows) * rowBytes;
+        for (uint32_t slot = 0; slot < slotCount; slot++)
+        {
+            std::tie(blockBuffers[slot], blockBufferMemorys[slot]) = createDeviceBuffer(blockSize, vk::BufferUsageFlagBits::eStorageBuffer);
+            std::tie(stagingBuffers[slot], stagingBufferMemorys[slot]) = createHostBuffer(blockSize, vk::BufferUsageFlagBits::eTransferSrc);
+            stagingPtrs[slot] = device.mapMemory(stagingBufferMemorys[slot], 0, blockSize);
+            filledSemaphores[slot] = device.createSemaphore({});
+            consumedSemaphores[slot] = device.createSemaphore({});
+            transferFences[slot] = device.createFence({});
+            slotUsed[slot] = false;
+        }
+        checkFence = device.createFence({});
+
+        arma::vec assumeX(n, arma::fill::zeros);
+        std::tie(vectorBBuffer, vectorBBufferMemory) = createStorageBuffer(rowBytes, vk::BufferUsageFlagBits::eStorageBuffer);
+        uploadToBuffer(vectorBBuffer, vectorBBufferMemory, b.memptr(), rowBytes);
+        std::tie(iterateBuffers[0], iterateBufferMemorys[0]) = createStorageBuffer(rowBytes, vk::BufferUsageFlagBits::eStorageBuffer);
+        uploadToBuffer(iterateBuffers[0], iterateBufferMemorys[0], assumeX.memptr(), rowBytes);
+        std::tie(iterateBuffers[1], iterateBufferMemorys[1]) = createStorageBuffer(rowBytes, vk::BufferUsageFlagBits::eStorageBuffer);
+
+        jacobiKernel.init(*this, "./shaders/jacobi.spv");
+        workGroupSize = chooseWorkGroupSize(n);
+        //the rounds are driven by the host, the check only reports convergence
+        convergenceCheck.init(*this, iterateBuffers[0], iterateBuffers[1], n, workGroupSize, { 0, 1, 1 }, tolerance);
+        recordCommandBuffers();
+    }
+
+    arma::vec run()
+    {
+        int calcRounds = maxRounds > 0 ? maxRounds : 5 * static_cast<int>(n);
+        SolverStatus status{};
+        int round = 0;
+        while (round < calcRounds && !status.converged)
+        {
+            for (uint32_t block = 0; block < blockCount; block++)
+            {
+                streamBlock(block, round % 2);
+            }
+            round++;
+            if (round % checkInterval == 0)
+            {
+                submitCompute(checkCommandBuffer, checkFence);
+                device.waitForFences(checkFence, VK_TRUE, UINT64_MAX);
+                device.resetFences(checkFence);
+                status = convergenceCheck.readStatus();
+            }
+        }
+        queue.waitIdle();
+        transferQueue.waitIdle();
+        releaseUploads();
+        releaseSemaphores();
+
+        report.iterations = round;
+        report.converged = status.converged != 0;
+        fmt::print("streaming jacobi {} after {} rounds of {} {} blocks x {} rows, max update {:e}\n",
+            report.converged ? "converged" : "did not converge", round, blockCount, resident ? "resident" : "streamed", blockRows, status.updateNorm);
+
+        //after round rounds the newest iterate is in iterateBuffers[round % 2]
+        arma::vec result(n);
+        readbackFromBuffer(iterateBuffers[round % 2], iterateBufferMemorys[round % 2], result.memptr(), n * sizeof(double));
+        return result;
+    }
+
+    inline const SolveReport& getReport()const { return report; }
+
+    void destroy()
+    {
+        for (uint32_t slot = 0; slot < slotCount; slot++)
+        {
+            device.unmapMemory(stagingBufferMemorys[slot]);
+            destroyBufferAndFreeMemory(stagingBuffers[slot], stagingBufferMemorys[slot]);
+            destroyBufferAndFreeMemory(blockBuffers[slot], blockBufferMemorys[slot]);
+            device.destroySemaphore(filledSemaphores[slot]);
+            device.destroySemaphore(consumedSemaphores[slot]);
+            device.destroyFence(transferFences[slot]);
+        }
+        device.destroyFence(checkFence);
+        destroyBufferAndFreeMemory(vectorBBuffer, vectorBBufferMemory);
+        destroyBufferAndFreeMemory(iterateBuffers[0], iterateBufferMemorys[0]);
+        destroyBufferAndFreeMemory(iterateBuffers[1], iterateBufferMemorys[1]);
+        device.freeCommandBuffers(transferCommandPool, transferCommandBuffers);
+        blockCommandBuffers.push_back(checkCommandBuffer);
+        device.freeCommandBuffers(commandPool, blockCommandBuffers);
+        jacobiKernel.destroy();
+        convergenceCheck.destroy();
+    }
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include<armadillo>
+
+//test systems shared by the demos and the benchmark
+
+//5-point Laplacian on a gridSize x gridSize grid with a shifted diagonal so Jacobi converges quickly
+inline arma::sp_mat createPoissonMatrix(arma::uword gridSize, double diagonal = 5.0)
+{
+    arma::uword n = gridSize * gridSize;
+    arma::sp_mat mat(n, n);
+    for (arma::uword y = 0; y < gridSize; y++)
+    {
+        for (arma::uword x = 0; x < gridSize; x++)
+        {
+            arma::uword row = y * gridSize + x;
+            mat(row, row) = diagonal;
+            if (x > 0)
+            {
+                mat(row, row - 1) = -1.0;
+            }
+            if (x + 1 < gridSize)
+            {
+                mat(row, row + 1) = -1.0;
+            }
+            if (y > 0)
+            {
+                mat(row, row - gridSize) = -1.0;
+            }
+            if (y + 1 < gridSize)
+            {
+                mat(row, row + gridSize) = -1.0;
+            }
+        }
+    }
+    return mat;
+}
+
+//dense symmetric positive definite system, random positive off diagonal entries and a dominant diagonal,
+//so D^-1 * A has the real positive eigenvalues Chebyshev acceleration needs.
+//each diagonal entry exceeds its row sum by diagonalShift, a larger shift makes Jacobi converge faster
+inline arma::mat createSymmetricDenseMatrix(arma::uword n, double diagonalShift = 3.0)
+{
+    arma::mat mat(n, n, arma::fill::randu);
+    mat = 0.5 * (mat + mat.t());
+    mat.diag() = arma::sum(mat, 1) + diagonalShift;
+    return mat;
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<functional>
+#include<vector>
+#include<algorithm>
+
+//fixed workers that all run the same task and join, the calling thread is worker 0,
+//solvers give worker i the same rows every time so its data stays in its caches and on its memory node
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency())
+    {
+        workerCount = std::max(1u, threadCount);
+        for (unsigned i = 1; i < workerCount; i++)
+        {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& i : workers)
+        {
+            i.join();
+        }
+    }
+
+    inline unsigned size()const { return workerCount; }
+
+    //runs task(i) on every worker i and returns once all of them finished
+    void run(const std::function<void(unsigned)>& task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            currentTask = &task;
+            pendingWorkers = workerCount - 1;
+            generation++;
+        }
+        wake.notify_all();
+        task(0);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pendingWorkers == 0; });
+        currentTask = nullptr;
+    }
+private:
+    unsigned workerCount = 1;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(unsigned)>* currentTask = nullptr;
+    unsigned pendingWorkers = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    void workerLoop(unsigned index)
+    {
+        uint64_t seenGeneration = 0;
+        while (true)
+        {
+            const std::function<void(unsigned)>* task = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping)
+                {
+                    return;
+                }
+                seenGeneration = generation;
+                task = currentTask;
+            }
+            (*task)(index);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pendingWorkers--;
+                if (pendingWorkers == 0)
+                {
+                    done.notify_one();
+                }
+            }
+        }
+    }
+};
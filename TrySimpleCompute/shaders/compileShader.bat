@@ -0,0 +1,25 @@
+cd /d "%~dp0"
+"%VULKAN_SDK%\Bin\glslc.exe" simpleCompute.comp -o simpleCompute.spv
+"%VULKAN_SDK%\Bin\glslc.exe" jacobi.comp -o jacobi.spv
+"%VULKAN_SDK%\Bin\glslc.exe" jacobiMultiRhs.comp -o jacobiMultiRhs.spv
+"%VULKAN_SDK%\Bin\glslc.exe" chebyshevJacobi.comp -o chebyshevJacobi.spv
+"%VULKAN_SDK%\Bin\glslc.exe" jacobiConvergence.comp -o jacobiConvergence.spv
+"%VULKAN_SDK%\Bin\glslc.exe" sparseJacobi.comp -o sparseJacobi.spv
+"%VULKAN_SDK%\Bin\glslc.exe" sparseGaussSeidel.comp -o sparseGaussSeidel.spv
+"%VULKAN_SDK%\Bin\glslc.exe" multicolorSor.comp -o multicolorSor.spv
+"%VULKAN_SDK%\Bin\glslc.exe" cgSpmv.comp -o cgSpmv.spv
+"%VULKAN_SDK%\Bin\glslc.exe" cgReduce.comp -o cgReduce.spv
+"%VULKAN_SDK%\Bin\glslc.exe" cgUpdateSolution.comp -o cgUpdateSolution.spv
+"%VULKAN_SDK%\Bin\glslc.exe" cgUpdateDirection.comp -o cgUpdateDirection.spv
+"%VULKAN_SDK%\Bin\glslc.exe" refineResidual.comp -o refineResidual.spv
+"%VULKAN_SDK%\Bin\glslc.exe" refineJacobi.comp -o refineJacobi.spv
+"%VULKAN_SDK%\Bin\glslc.exe" refineCorrect.comp -o refineCorrect.spv
+"%VULKAN_SDK%\Bin\glslc.exe" batchedJacobi.comp -o batchedJacobi.spv
+"%VULKAN_SDK%\Bin\glslc.exe" elementwise.comp -o elementwise.spv
+"%VULKAN_SDK%\Bin\glslc.exe" reduce.comp -o reduce.spv
+"%VULKAN_SDK%\Bin\glslc.exe" --target-env=vulkan1.1 reduceSubgroup.comp -o reduceSubgroup.spv
+"%VULKAN_SDK%\Bin\glslc.exe" gemv.comp -o gemv.spv
+"%VULKAN_SDK%\Bin\glslc.exe" gemvFloat.comp -o gemvFloat.spv
+"%VULKAN_SDK%\Bin\glslc.exe" gemm.comp -o gemm.spv
+"%VULKAN_SDK%\Bin\glslc.exe" gemmFloat.comp -o gemmFloat.spv
+pause
@@ -0,0 +1,121 @@
+//C = alpha * A * B + beta * C with column major A (m x k), B (k x n) and C (m x n), shared by gemm.comp and gemmFloat.comp.
+//a workgroup of 64 invocations computes a 32 x 32 tile of C, every invocation a 4 x 4 block of it in registers,
+//A and B pass through shared memory in slices of tileK columns and rows
+layout(local_size_x_id = 0, local_size_y = 1, local_size_z = 1)in;
+
+//A holds A^T (k x m, column stride lda), the product uses its transpose
+layout(constant_id = 1) const bool transposeA = false;
+
+//the host always dispatches threadsPerSide * threadsPerSide invocations per workgroup
+const uint threadsPerSide = 8;
+const uint blockSize = 4;
+const uint tileSize = threadsPerSide * blockSize;
+const uint tileK = 16;
+
+layout(set = 0, binding = 0) readonly buffer MatrixA
+{
+    SCALAR data[];
+}mata;
+
+layout(set = 0, binding = 1) readonly buffer MatrixB
+{
+    SCALAR data[];
+}matb;
+
+layout(set = 0, binding = 2) buffer MatrixC
+{
+    SCALAR data[];
+}matc;
+
+layout(push_constant) uniform ConstantBlock
+{
+    uint m;
+    uint n;
+    uint k;
+    uint lda;
+    uint ldb;
+    uint ldc;
+    SCALAR alpha;
+    SCALAR beta;
+}pushConst;
+
+//tileA[kk][i] is A(tileRow + i, k0 + kk), tileB[kk][j] is B(k0 + kk, tileCol + j)
+shared SCALAR tileA[tileK][tileSize];
+shared SCALAR tileB[tileK][tileSize];
+
+void main()
+{
+    uint lane = gl_LocalInvocationID.x;
+    uint tileRow = gl_WorkGroupID.x * tileSize;
+    uint tileCol = gl_WorkGroupID.y * tileSize;
+    //rows and columns of a block are threadsPerSide apart, so neighbouring lanes read neighbouring shared memory words
+    uint laneRow = lane % threadsPerSide;
+    uint laneCol = lane / threadsPerSide;
+    uint threadCount = threadsPerSide * threadsPerSide;
+
+    SCALAR sums[blockSize][blockSize];
+    for(uint r = 0; r < blockSize; r++)
+    {
+        for(uint c = 0; c < blockSize; c++)
+        {
+            sums[r][c] = SCALAR(0);
+        }
+    }
+
+    for(uint k0 = 0; k0 < pushConst.k; k0 += tileK)
+    {
+        //consecutive lanes load consecutive rows of A and consecutive k of B, both contiguous in column major storage
+        for(uint e = lane; e < tileK * tileSize; e += threadCount)
+        {
+            //a transposed A is contiguous along k, so there consecutive lanes take consecutive k
+            uint i = transposeA ? e / tileK : e % tileSize;
+            uint kk = transposeA ? e % tileK : e / tileSize;
+            uint row = tileRow + i;
+            uint col = k0 + kk;
+            uint elementA = transposeA ? row * pushConst.lda + col : col * pushConst.lda + row;
+            tileA[kk][i] = row < pushConst.m && col < pushConst.k ? mata.data[elementA] : SCALAR(0);
+
+            uint bk = e % tileK;
+            uint j = e / tileK;
+            uint bRow = k0 + bk;
+            uint bCol = tileCol + j;
+            tileB[bk][j] = bRow < pushConst.k && bCol < pushConst.n ? matb.data[bCol * pushConst.ldb + bRow] : SCALAR(0);
+        }
+        memoryBarrierShared();
+        barrier();
+
+        for(uint kk = 0; kk < tileK; kk++)
+        {
+            SCALAR a[blockSize];
+            SCALAR b[blockSize];
+            for(uint r = 0; r < blockSize; r++)
+            {
+                a[r] = tileA[kk][laneRow + r * threadsPerSide];
+                b[r] = tileB[kk][laneCol + r * threadsPerSide];
+            }
+            for(uint r = 0; r < blockSize; r++)
+            {
+                for(uint c = 0; c < blockSize; c++)
+                {
+                    sums[r][c] += a[r] * b[c];
+                }
+            }
+        }
+        barrier();
+    }
+
+    for(uint c = 0; c < blockSize; c++)
+    {
+        uint col = tileCol + laneCol + c * threadsPerSide;
+        for(uint r = 0; r < blockSize; r++)
+        {
+            uint row = tileRow + laneRow + r * threadsPerSide;
+            if(row < pushConst.m && col < pushConst.n)
+            {
+                uint element = col * pushConst.ldc + row;
+                SCALAR old = pushConst.beta != SCALAR(0) ? pushConst.beta * matc.data[element] : SCALAR(0);
+                matc.data[element] = pushConst.alpha * sums[r][c] + old;
+            }
+        }
+    }
+}
@@ -0,0 +1,134 @@
+//y = alpha * op(A) * x + beta * y with column major A, shared by gemv.comp and gemvFloat.comp which define SCALAR.
+//op(A) = A: every invocation keeps rowsPerInvocation rows in registers, x is staged through shared memory one tile at a time
+//and the lanes of a workgroup read consecutive elements of each column.
+//op(A) = A^T: one workgroup per output, the lanes read consecutive elements of a column and reduce in shared memory
+layout(local_size_x_id = 0, local_size_y = 1, local_size_z = 1)in;
+
+layout(constant_id = 1) const bool transposed = false;
+
+const uint rowsPerInvocation = 4;
+
+layout(set = 0, binding = 0) readonly buffer MatrixA
+{
+    SCALAR data[];
+}mata;
+
+layout(set = 0, binding = 1) readonly buffer VectorX
+{
+    SCALAR data[];
+}vecx;
+
+layout(set = 0, binding = 2) buffer VectorY
+{
+    SCALAR data[];
+}vecy;
+
+//m and n are the size of op(A)
+layout(push_constant) uniform ConstantBlock
+{
+    uint m;
+    uint n;
+    uint lda;
+    uint padding;
+    SCALAR alpha;
+    SCALAR beta;
+}pushConst;
+
+shared SCALAR sharedValues[gl_WorkGroupSize.x];
+
+//beta == 0 overwrites y without reading it, so y may start uninitialized
+void storeY(uint row, SCALAR value)
+{
+    SCALAR old = pushConst.beta != SCALAR(0) ? pushConst.beta * vecy.data[row] : SCALAR(0);
+    vecy.data[row] = pushConst.alpha * value + old;
+}
+
+void multiply()
+{
+    uint lane = gl_LocalInvocationID.x;
+    uint firstRow = gl_WorkGroupID.x * gl_WorkGroupSize.x * rowsPerInvocation + lane;
+    SCALAR sums[rowsPerInvocation];
+    for(uint r = 0; r < rowsPerInvocation; r++)
+    {
+        sums[r] = SCALAR(0);
+    }
+
+    for(uint tileBegin = 0; tileBegin < pushConst.n; tileBegin += gl_WorkGroupSize.x)
+    {
+        uint col = tileBegin + lane;
+        sharedValues[lane] = col < pushConst.n ? vecx.data[col] : SCALAR(0);
+        memoryBarrierShared();
+        barrier();
+
+        uint tileSize = min(gl_WorkGroupSize.x, pushConst.n - tileBegin);
+        for(uint k = 0; k < tileSize; k++)
+        {
+            SCALAR xk = sharedValues[k];
+            uint columnBegin = (tileBegin + k) * pushConst.lda;
+            for(uint r = 0; r < rowsPerInvocation; r++)
+            {
+                uint row = firstRow + r * gl_WorkGroupSize.x;
+                if(row < pushConst.m)
+                {
+                    sums[r] += mata.data[columnBegin + row] * xk;
+                }
+            }
+        }
+        barrier();
+    }
+
+    for(uint r = 0; r < rowsPerInvocation; r++)
+    {
+        uint row = firstRow + r * gl_WorkGroupSize.x;
+        if(row < pushConst.m)
+        {
+            storeY(row, sums[r]);
+        }
+    }
+}
+
+void multiplyTransposed()
+{
+    uint lane = gl_LocalInvocationID.x;
+    //grid stride over the outputs, the host caps the workgroup count
+    for(uint row = gl_WorkGroupID.x; row < pushConst.m; row += gl_NumWorkGroups.x)
+    {
+        uint columnBegin = row * pushConst.lda;
+        SCALAR temp = SCALAR(0);
+        for(uint k = lane; k < pushConst.n; k += gl_WorkGroupSize.x)
+        {
+            temp += mata.data[columnBegin + k] * vecx.data[k];
+        }
+        sharedValues[lane] = temp;
+        memoryBarrierShared();
+        barrier();
+
+        for(uint stride = gl_WorkGroupSize.x / 2; stride > 0; stride >>= 1)
+        {
+            if(lane < stride)
+            {
+                sharedValues[lane] += sharedValues[lane + stride];
+            }
+            memoryBarrierShared();
+            barrier();
+        }
+
+        if(lane == 0)
+        {
+            storeY(row, sharedValues[0]);
+        }
+        barrier();
+    }
+}
+
+void main()
+{
+    if(transposed)
+    {
+        multiplyTransposed();
+    }
+    else
+    {
+        multiply();
+    }
+}
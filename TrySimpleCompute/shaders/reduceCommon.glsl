@@ -0,0 +1,138 @@
+//shared part of reduce.comp and reduceSubgroup.comp, which only differ in reduceWorkGroup.
+//the first pass reduces the input into one partial per workgroup, the last pass reduces the partials into a result slot,
+//a grid stride loop keeps the number of workgroups and so the number of partials small enough for a single second pass
+layout(local_size_x_id = 0, local_size_y = 1, local_size_z = 1)in;
+
+//Reduction::Op in Reduction.h
+layout(constant_id = 1) const uint reduceOp = 0;
+//the inputs hold floats, partials and results are double either way
+layout(constant_id = 2) const bool floatInput = false;
+
+const uint opSum = 0;
+const uint opDot = 1;
+const uint opNorm2 = 2;
+const uint opMax = 3;
+const uint opMaxAbs = 4;
+const uint opArgMax = 5;
+const uint opArgMaxAbs = 6;
+const bool takesMax = reduceOp >= opMax;
+const double lowest = -1.7976931348623157e308LF;
+const uint noIndex = 0xffffffffu;
+
+//ReductionResult in Reduction.h
+struct Partial
+{
+    double value;
+    uint index;
+    uint padding;
+};
+
+layout(set = 0, binding = 0) readonly buffer VectorX
+{
+    double data[];
+}x;
+
+layout(set = 0, binding = 0) readonly buffer VectorXFloat
+{
+    float data[];
+}xFloat;
+
+layout(set = 0, binding = 1) readonly buffer VectorY
+{
+    double data[];
+}y;
+
+layout(set = 0, binding = 1) readonly buffer VectorYFloat
+{
+    float data[];
+}yFloat;
+
+layout(set = 0, binding = 2) buffer Partials
+{
+    Partial data[];
+}partials;
+
+layout(set = 0, binding = 3) buffer Results
+{
+    Partial data[];
+}results;
+
+layout(push_constant) uniform ConstantBlock
+{
+    uint count;
+    uint fromPartials;
+    uint toResult;
+    uint resultIndex;
+}pushConst;
+
+Partial identity()
+{
+    return Partial(takesMax ? lowest : 0.0LF, noIndex, 0u);
+}
+
+//ties keep the lower index, so argmax does not depend on the order of the tree
+Partial combine(Partial a, Partial b)
+{
+    if(!takesMax)
+    {
+        a.value += b.value;
+        return a;
+    }
+    if(b.value > a.value || (b.value == a.value && b.index < a.index))
+    {
+        return b;
+    }
+    return a;
+}
+
+Partial element(uint i)
+{
+    if(pushConst.fromPartials != 0)
+    {
+        return partials.data[i];
+    }
+    double value = floatInput ? double(xFloat.data[i]) : x.data[i];
+    if(reduceOp == opDot)
+    {
+        value *= floatInput ? double(yFloat.data[i]) : y.data[i];
+    }
+    else if(reduceOp == opNorm2)
+    {
+        value *= value;
+    }
+    else if(reduceOp == opMaxAbs || reduceOp == opArgMaxAbs)
+    {
+        value = abs(value);
+    }
+    return Partial(value, i, 0u);
+}
+
+//the result is only needed in invocation 0
+Partial reduceWorkGroup(Partial p);
+
+void main()
+{
+    Partial p = identity();
+    uint gridSize = gl_NumWorkGroups.x * gl_WorkGroupSize.x;
+    for(uint i = gl_GlobalInvocationID.x; i < pushConst.count; i += gridSize)
+    {
+        p = combine(p, element(i));
+    }
+    p = reduceWorkGroup(p);
+
+    if(gl_LocalInvocationID.x == 0)
+    {
+        if(pushConst.toResult != 0)
+        {
+            if(reduceOp == opNorm2)
+            {
+                p.value = sqrt(p.value);
+            }
+            results.data[pushConst.resultIndex] = p;
+        }
+        else
+        {
+            partials.data[gl_WorkGroupID.x] = p;
+        }
+    }
+}